@@ -41,8 +41,8 @@ int main(int argc, char **argv)
      * raw memory map of the file. Instead, read returns to the user a copy of
      * the decompressed data.
      */
-    auto zlib_data = zlib_array.read().get();
-    verify(zlib_data, zlib_array.get_shape()[0]);
+    auto zlib_data = zlib_array.read();
+    verify(zlib_data.get(), zlib_array.get_shape()[0]);
 
     /* Read array that is known to be compressed with bzp2 */
     auto bzp2_array = asdf.get_array<int>(tree["bzp2_data"]);
@@ -51,6 +51,15 @@ int main(int argc, char **argv)
     assert(bzp2_array.get_compression_type() == CompressionType::bzip2);
     assert(bzp2_array.is_compressed() == true);
 
-    auto bzp2_data = bzp2_array.read().get();
-    verify(bzp2_data, bzp2_array.get_shape()[0]);
+    auto bzp2_data = bzp2_array.read();
+    verify(bzp2_data.get(), bzp2_array.get_shape()[0]);
+
+    /*
+     * When reading many arrays of the same size, read_into can be used to
+     * decompress directly into a buffer owned by the application, which
+     * avoids an allocation for every read.
+     */
+    std::vector<int> buffer(bzp2_array.get_num_elements());
+    bzp2_array.read_into(buffer.data(), buffer.size());
+    verify(buffer.data(), buffer.size());
 }
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+
+
+namespace Asdf {
+
+template <typename T> class NDArray;
+
+/*
+ * A typed, shape-aware view of array data. The view shares ownership of the
+ * underlying memory, which is usually the memory map of the file itself, so
+ * it remains valid even after the AsdfFile that created it goes away. Views of
+ * read-only data have a const element type; writable views must be flushed
+ * for changes to reach the file.
+ */
+template <typename T>
+class ArrayView
+{
+    public:
+        ArrayView() { };
+
+        ArrayView(std::shared_ptr<T> data, std::vector<size_t> shape,
+                  bool is_copy = false)
+        {
+            this->buffer = data;
+            this->shape = shape;
+            this->copied = is_copy;
+
+            /* Row-major strides, measured in elements */
+            strides.resize(shape.size());
+            ptrdiff_t stride = 1;
+            for (size_t i = shape.size(); i > 0; i--)
+            {
+                strides[i - 1] = stride;
+                stride *= shape[i - 1];
+            }
+        }
+
+        /*
+         * A view of elements that are laid out with the given strides, which
+         * are measured in elements and may be negative. The data pointer
+         * refers to the first element, i.e. the one at index (0, 0, ...).
+         */
+        ArrayView(std::shared_ptr<T> data, std::vector<size_t> shape,
+                  std::vector<ptrdiff_t> strides, bool is_copy = false) :
+            ArrayView(data, shape, is_copy)
+        {
+            if (strides.size() != shape.size())
+            {
+                throw std::runtime_error(
+                    "Strides must have the same number of dimensions as the shape");
+            }
+
+            this->strides = strides;
+            this->contiguous = is_contiguous();
+        }
+
+        T * data(void) const
+        {
+            return buffer.get();
+        }
+
+        std::vector<size_t> get_shape(void) const
+        {
+            return shape;
+        }
+
+        size_t size(void) const
+        {
+            return std::accumulate(shape.begin(), shape.end(), (size_t) 1,
+                                   std::multiplies<size_t>());
+        }
+
+        /* Distance between neighbouring elements along each dimension */
+        std::vector<ptrdiff_t> get_strides(void) const
+        {
+            return strides;
+        }
+
+        /*
+         * Indicates whether the elements are stored contiguously in row-major
+         * order, so that data() can be used as a plain array.
+         */
+        bool is_contiguous(void) const
+        {
+            ptrdiff_t stride = 1;
+            for (size_t i = shape.size(); i > 0; i--)
+            {
+                if (shape[i - 1] > 1 && strides[i - 1] != stride)
+                {
+                    return false;
+                }
+
+                stride *= shape[i - 1];
+            }
+
+            return true;
+        }
+
+        /* Indicates whether the view refers to a copy rather than the file */
+        bool is_copy(void) const
+        {
+            return copied;
+        }
+
+        /*
+         * Writes changes made through a writable view back to the file. This
+         * has no effect on other views.
+         */
+        void flush(void) const
+        {
+            if (flusher)
+            {
+                flusher();
+            }
+        }
+
+        /* Access by flat (row-major) element index */
+        T & operator[](size_t index) const
+        {
+            if (contiguous)
+            {
+                return buffer.get()[index];
+            }
+
+            ptrdiff_t offset = 0;
+            for (size_t i = shape.size(); i > 0; i--)
+            {
+                offset += (ptrdiff_t) (index % shape[i - 1]) * strides[i - 1];
+                index /= shape[i - 1];
+            }
+
+            return buffer.get()[offset];
+        }
+
+        /* Access by multi-dimensional index, e.g. view(i, j) */
+        template <typename... Indices>
+        T & operator()(Indices... indices) const
+        {
+            static_assert(sizeof...(Indices) > 0, "At least one index is required");
+
+            const size_t index_list[] = { (size_t) indices... };
+            if (sizeof...(Indices) != shape.size())
+            {
+                throw std::runtime_error(
+                    "Number of indices does not match array dimensions");
+            }
+
+            ptrdiff_t offset = 0;
+            for (size_t i = 0; i < sizeof...(Indices); i++)
+            {
+                offset += (ptrdiff_t) index_list[i] * strides[i];
+            }
+
+            return buffer.get()[offset];
+        }
+
+    private:
+        template <typename U> friend class NDArray;
+
+        std::shared_ptr<T> buffer;
+        std::vector<size_t> shape;
+        std::vector<ptrdiff_t> strides;
+        bool contiguous = true;
+        bool copied = false;
+        std::function<void(void)> flusher;
+};
+
+} /* namespace Asdf */
@@ -6,12 +6,18 @@
 #include <string>
 #include <vector>
 #include <numeric>
+#include <memory>
+#include <future>
 
 #include <cstdint>
 
 #include "node.hpp"
 #include "compression.hpp"
 #include "block_manager.hpp"
+#include "file_data.hpp"
+#include "thread_pool.hpp"
+#include "stream_writer.hpp"
+#include "file_writer.hpp"
 #include "tags/ndarray.hpp"
 
 namespace Asdf {
@@ -22,7 +28,7 @@ class AsdfFile
         /* Constructors */
         AsdfFile();
         /* TODO: consider providing a factory method here instead */
-        AsdfFile(std::string filename);
+        AsdfFile(std::string filename, AccessMode mode = read_only);
         AsdfFile(std::stringstream &stream);
         ~AsdfFile(void);
 
@@ -34,19 +40,33 @@ class AsdfFile
         friend std::ostream&
             operator<<(std::ostream& stream, const AsdfFile &af);
 
+        /*
+         * Writes the file to disk through a file descriptor rather than an
+         * iostream. With direct_io the data bypasses the page cache, which is
+         * useful for very large files that won't be read back soon.
+         */
+        void write_to(std::string filename, bool direct_io = false) const;
+
+        /*
+         * Creates an array node for the given data. The data is written in the
+         * given byte order, converting it on the fly if that is not the native
+         * one, so the caller's buffer is left untouched.
+         */
         template <typename T> NDArray<T> create_array_node(
             T *data,
             size_t size,
-            CompressionType compression = CompressionType::none)
+            CompressionOptions compression = CompressionType::none,
+            ByteOrder byteorder = native_byte_order)
         {
             return create_array_node(data, std::vector<size_t> { size },
-                                     compression);
+                                     compression, byteorder);
         }
 
         template <typename T> NDArray<T> create_array_node(
             T *data,
             std::vector<size_t> shape,
-            CompressionType compression = CompressionType::none)
+            CompressionOptions compression = CompressionType::none,
+            ByteOrder byteorder = native_byte_order)
         {
             using std::accumulate;
             using std::multiplies;
@@ -56,43 +76,315 @@ class AsdfFile
             auto size = accumulate(begin(shape), end(shape), 1,
                                    multiplies<size_t>());
 
-            int block_id = block_manager.add_data_block<T>(data, size,
-                                                           compression);
+            NDArray<T> array(-1, shape, compression);
+
+            if (inline_threshold > 0 and size <= inline_threshold)
+            {
+                const uint8_t *bytes = (const uint8_t *) data;
+                array.set_inline_data(
+                        std::vector<uint8_t>(bytes, bytes + size * sizeof(T)));
+
+                return array;
+            }
+
+            array.byteorder = ByteOrder_to_string(byteorder);
+            array.source = block_manager.add_data_block<T>(data, size,
+                    compression, needs_swap<T>(array.byteorder));
+
+            return array;
+        }
+
+        /*
+         * Creates an array that is stored as a grid of independently
+         * compressed chunks of the given shape. This allows a region of the
+         * array to be read without decompressing all of it.
+         */
+        template <typename T> NDArray<T> create_array_node(
+            T *data,
+            std::vector<size_t> shape,
+            CompressionOptions compression,
+            std::vector<size_t> chunk_shape,
+            ByteOrder byteorder = native_byte_order)
+        {
+            if (chunk_shape.empty())
+            {
+                return create_array_node(data, shape, compression, byteorder);
+            }
+
+            const std::string order = ByteOrder_to_string(byteorder);
+            auto sources = block_manager.add_chunked_data_blocks<T>(
+                    data, shape, chunk_shape, compression, needs_swap<T>(order));
+
+            NDArray<T> array(sources, shape, chunk_shape, compression);
+            array.byteorder = order;
+
+            return array;
+        }
+
+        /*
+         * Creates an array node that shares the data block of an array made
+         * by create_array_node, e.g. to store a transposed or sliced view of
+         * the same data without writing it twice. The offset of the first
+         * element and the strides are measured in bytes within the data of
+         * the base array, and strides may be negative.
+         */
+        template <typename T> NDArray<T> create_array_view(
+            const NDArray<T> &base,
+            std::vector<size_t> shape,
+            std::vector<ptrdiff_t> strides,
+            size_t offset = 0)
+        {
+            if (base.is_chunked() or base.is_streamed() or base.source < 0 or
+                not base.has_default_layout())
+            {
+                throw std::runtime_error(
+                    "Views can only be made of arrays that have their own block");
+            }
+
+            NDArray<T> view(base, shape, strides, offset);
+            view.check_layout(NDArray<T>::count_elements(base.shape) * sizeof(T));
+
+            return view;
+        }
+
+        /*
+         * Creates an array whose rows are appended to the end of the file
+         * after everything else has been written (see write_streamed). Each
+         * row has the given shape, and the number of rows is inferred from the
+         * length of the file when it is read back. A file can contain at most
+         * one streamed array.
+         */
+        template <typename T> NDArray<T> create_streamed_array_node(
+            std::vector<size_t> row_shape = {})
+        {
+            block_manager.add_streamed_block();
+
+            streamed_row_size = std::accumulate(row_shape.begin(),
+                    row_shape.end(), (size_t) 1, std::multiplies<size_t>());
+            streamed_datatype = dtype_to_string<T>();
+
+            return NDArray<T>(row_shape);
+        }
+
+        /*
+         * Writes the tree and all of the blocks, and then returns a writer
+         * that appends rows to the streamed array.
+         */
+        template <typename T> StreamWriter<T> write_streamed(
+            std::ostream &ostream,
+            size_t buffer_size = DEFAULT_STREAM_BUFFER_SIZE) const
+        {
+            if (not block_manager.has_streamed_block())
+            {
+                throw std::runtime_error("No streamed array has been created");
+            }
+
+            if (streamed_datatype != dtype_to_string<T>())
+            {
+                throw std::runtime_error(
+                    "Streamed array has datatype " + streamed_datatype);
+            }
 
-            return NDArray<T>(block_id, shape, compression);
+            ostream << *this;
+
+            return StreamWriter<T>(ostream, streamed_row_size, buffer_size);
         }
 
         template <typename T> NDArray<T> get_array(Node node) const
         {
             auto array = node.as<NDArray<T>>();
-            array.set_array_block(blocks[array.get_source()]);
+            attach_blocks(array);
 
             return array;
         }
 
+        /*
+         * Returns the array at the given node without fixing its element type
+         * at compile time. The datatype is available from the handle, and the
+         * data can be read and converted to any supported type with read_as.
+         */
+        GenericNDArray get_generic_array(Node node) const;
+
+        /*
+         * Reads each of the arrays at the given nodes on the worker pool. The
+         * data blocks are decompressed and byteswapped concurrently, and the
+         * results are delivered through the returned futures in the same
+         * order as the nodes.
+         */
+        template <typename T>
+        std::vector<std::future<std::shared_ptr<T>>>
+            read_arrays(std::vector<Node> nodes) const
+        {
+            std::vector<std::future<std::shared_ptr<T>>> futures;
+            ThreadPool &pool = get_thread_pool();
+
+            /* The tree is not thread safe, so resolve the arrays here */
+            for (auto node : nodes)
+            {
+                auto array = get_array<T>(node);
+                futures.push_back(pool.submit([array]() { return array.read(); }));
+            }
+
+            return futures;
+        }
+
+        /*
+         * Configures the worker pool used by batch operations. A value of 0
+         * uses one thread per available core, which is also the default.
+         */
+        void set_num_threads(size_t num_threads);
+        /*
+         * Enables compressing blocks concurrently on the worker pool when the
+         * file is written. Compressed blocks are staged in memory until their
+         * turn to be written; max_in_flight bounds the uncompressed size of
+         * the blocks that are being compressed or waiting to be written.
+         */
+        void set_parallel_write(bool enable,
+                                size_t max_in_flight = DEFAULT_MAX_IN_FLIGHT);
+        /* Allows a pool to be shared among several files */
+        void set_thread_pool(std::shared_ptr<ThreadPool> pool);
+        ThreadPool &get_thread_pool(void) const;
+
+        /*
+         * Controls whether the MD5 checksum of each block is computed when
+         * the file is written. This is enabled by default; pipelines that
+         * trust their storage can skip the cost by disabling it.
+         */
+        void set_checksums(bool enable);
+
+        /*
+         * Controls which arrays created from now on share a data block (see
+         * DedupMode). By default, arrays made from the same buffer share one.
+         * Content deduplication also catches identical data in different
+         * buffers, such as masks that are repeated across entries. Their
+         * contents are compared when the file is written.
+         */
+        void set_block_dedup(DedupMode mode);
+
+        /*
+         * Arrays created from now on that have at most this many elements are
+         * stored as inline data in the tree instead of in a block, which
+         * makes files with many tiny arrays smaller and faster to open. The
+         * compression and byte order of such arrays are ignored. This is
+         * disabled by default, with a threshold of 0.
+         */
+        void set_inline_threshold(size_t max_elements);
+
+        /*
+         * Checks the data of every block against its recorded checksum, on
+         * the worker pool. Blocks without a checksum always pass. Returns the
+         * sources of the blocks that failed, so an empty result means that
+         * no corruption was found.
+         */
+        std::vector<int> verify_checksums(void) const;
+
+        /*
+         * Same as above, but runs in the background, e.g. right after the
+         * file is opened. The check keeps the file data alive, so the
+         * AsdfFile does not need to outlive it.
+         */
+        std::future<std::vector<int>> verify_checksums_async(void) const;
+
+        /*
+         * Reserves space when the file is written so that it can be updated
+         * in place later: tree_padding bytes after the YAML tree, and
+         * block_headroom (as a fraction of the data size) after each block.
+         */
+        void set_padding(size_t tree_padding, double block_headroom = 0.0);
+
+        /*
+         * Rewrites the tree of a file opened in read_write mode in place,
+         * without reading or moving any of the blocks. Returns false, leaving
+         * the file unchanged, if the new tree does not fit before the first
+         * block.
+         */
+        bool update_tree(void);
+
+        /*
+         * Replaces the contents of a block of a file opened in read_write
+         * mode, compressing the given data if requested. The data is stored
+         * as-is, so it must be in the byte order recorded in the tree. Returns
+         * false, leaving the block unchanged, if the data does not fit in the
+         * space allocated for the block. Shuffle filters are not supported
+         * here, since the size of the elements is not known.
+         */
+        bool update_block(int source, const void *data, size_t size,
+                          CompressionOptions compression = CompressionType::none);
+
+        /*
+         * Writes the arrays that were created since a file was opened in
+         * read_write mode after its existing blocks, followed by a new block
+         * index, and then rewrites the tree in place. The existing blocks are
+         * neither read nor moved. ASDF has no way of referring to a tree that
+         * lives elsewhere, so the new tree must fit before the first block
+         * (see set_padding); otherwise nothing is written and an exception is
+         * thrown. The file is reloaded afterwards, so nodes obtained from the
+         * tree beforehand no longer refer to it.
+         */
+        void append(void);
+
     private:
         /* Private members */
         BlockManager block_manager;
 
         Node asdf_tree;
 
-        int fd = -1;
-        size_t data_size = 0;
-        /* TODO: make this a shared pointer */
+        /* Only set for files that were opened by name */
+        std::string filename;
+        AccessMode mode = read_only;
+
+        /* Shared with any array views so that the data can outlive us */
+        std::shared_ptr<FileData> file_data;
         uint8_t *data = nullptr;
+        size_t data_size = 0;
 
-        bool memmapped = false;
+        /* Offset of the first byte following the YAML tree */
+        size_t end_index = 0;
 
-        std::streampos end_index = 0;
+        /*
+         * When the block locations come from the block index they are only
+         * validated as they are accessed, and we fall back to walking the
+         * blocks if the index turns out to be stale.
+         */
+        mutable std::vector<uint8_t *> blocks;
+        mutable bool blocks_from_index = false;
 
-        std::vector<uint8_t *> blocks;
+        /* Created on first use unless one is provided */
+        mutable std::shared_ptr<ThreadPool> thread_pool;
+        size_t num_threads = 0;
+
+        size_t streamed_row_size = 0;
+        std::string streamed_datatype;
+
+        bool parallel_write = false;
+        size_t max_in_flight = DEFAULT_MAX_IN_FLIGHT;
+
+        size_t tree_padding = 0;
+
+        /* Largest number of elements that is stored inline */
+        size_t inline_threshold = 0;
 
         /* Private methods */
-        void write_blocks(std::ostream &ostream) const;
-        void setup_memmap(std::string filename);
-        void copy_stream(std::iostream &stream);
+        std::string render_tree(const std::vector<int> &duplicates) const;
+
+        /* Whether data of type T in the given byte order must be swapped */
+        template <typename T> static bool needs_swap(std::string byteorder)
+        {
+            return sizeof(T) > 1 && byteorder != get_system_byte_order();
+        }
+        void write_blocks(std::ostream &ostream, size_t offset,
+                          const std::vector<int> &duplicates) const;
+        void setup_file_data(std::shared_ptr<FileData> file_data);
+        void parse_file_data(void);
+        void open_file(void);
 
         void find_blocks(void);
+        bool find_indexed_blocks(void);
+        void walk_blocks(void) const;
+        bool valid_block(const uint8_t *block, const uint8_t *limit) const;
+        const uint8_t *get_block(int source) const;
+        /* Associates an array that was read from the tree with its blocks */
+        void attach_blocks(GenericNDArray &array) const;
 
 }; /* AsdfFile class */
 } /* namespace Asdf */
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <vector>
 #include <assert.h>
 #include <cstdint>
 #include <cstring>
@@ -11,8 +12,15 @@
 const uint8_t asdf_block_magic[] = {0xd3, 'B', 'L', 'K'};
 const uint8_t zlib_compression[] = {'z', 'l', 'i', 'b'};
 const uint8_t bzp2_compression[] = {'b', 'z', 'p', '2'};
+const uint8_t zstd_compression[] = {'z', 's', 't', 'd'};
+const uint8_t lz4_compression[] = {'l', 'z', '4', '\0'};
 const uint8_t no_compression[] = { 0, 0, 0, 0 };
 
+#define BLOCK_INDEX_HEADER  "#ASDF BLOCK INDEX"
+
+/* Indicates a block whose data extends to the end of the file */
+#define BLOCK_FLAG_STREAMED 0x1
+
 
 #pragma pack(push, 1)
 typedef struct block_header
@@ -66,6 +74,16 @@ typedef struct block_header
         header_size[1] = size & 0xff;
     }
 
+    /* The flags are stored big-endian like every other field */
+    void set_flags(uint32_t value)
+    {
+        uint8_t *bytes = (uint8_t *) &flags;
+        bytes[0] = (value >> 24) & 0xff;
+        bytes[1] = (value >> 16) & 0xff;
+        bytes[2] = (value >> 8) & 0xff;
+        bytes[3] = value & 0xff;
+    }
+
     void set_allocated_size(uint64_t size)
     {
         unpack_u64be(allocated_size, size);
@@ -91,6 +109,12 @@ typedef struct block_header
             case bzip2:
                 memcpy(compression, bzp2_compression, sizeof(compression));
                 break;
+            case zstd:
+                memcpy(compression, zstd_compression, sizeof(compression));
+                break;
+            case lz4:
+                memcpy(compression, lz4_compression, sizeof(compression));
+                break;
             default:
                 memcpy(compression, no_compression, sizeof(compression));
                 break;
@@ -109,6 +133,18 @@ typedef struct block_header
         return get_header_size() + sizeof(this->magic) + sizeof(this->header_size);
     }
 
+    uint32_t get_flags() const
+    {
+        const uint8_t *bytes = (const uint8_t *) &flags;
+        return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) |
+               ((uint32_t) bytes[2] << 8) | bytes[3];
+    }
+
+    bool is_streamed() const
+    {
+        return (get_flags() & BLOCK_FLAG_STREAMED) != 0;
+    }
+
     uint64_t get_allocated_size() const
     {
         return pack_u64be(allocated_size);
@@ -134,6 +170,14 @@ typedef struct block_header
         {
             return bzip2;
         }
+        else if (memcmp(compression, zstd_compression, sizeof(compression)) == 0)
+        {
+            return zstd;
+        }
+        else if (memcmp(compression, lz4_compression, sizeof(compression)) == 0)
+        {
+            return lz4;
+        }
         else if (memcmp(compression, no_compression, sizeof(compression)) == 0)
         {
             return none;
@@ -153,9 +197,43 @@ static_assert(sizeof(block_header_t) == 0x36, "Invalid block header size");
 
 
 void *process_block_data(const uint8_t *block_data);
+void read_block_data(const uint8_t *block_data, void *output, size_t capacity);
+void read_block_windows(const uint8_t *block_data, size_t alignment,
+                        const WindowConsumer &consume);
+void compute_checksum(uint8_t checksum[16], const uint8_t *data, size_t size);
+void update_block_checksum(uint8_t *block_data);
+bool verify_block_checksum(const uint8_t *block_data);
 void write_compressed_block(
         std::ostream &stream,
         size_t *compressed_size,
         const uint8_t *raw_data,
         size_t data_size,
-        CompressionType compression);
+        const CompressionOptions &compression,
+        uint8_t *checksum = nullptr,
+        const InputFilter &filter = InputFilter());
+void compress_block_data(
+        std::vector<uint8_t> &output,
+        const uint8_t *raw_data,
+        size_t data_size,
+        const CompressionOptions &compression,
+        uint8_t *checksum = nullptr,
+        const InputFilter &filter = InputFilter());
+
+void compute_filtered_checksum(
+        uint8_t checksum[16],
+        const uint8_t *data,
+        size_t size,
+        const InputFilter &filter);
+void write_filtered_data(
+        std::ostream &stream,
+        const uint8_t *data,
+        size_t size,
+        const InputFilter &filter,
+        uint8_t *checksum = nullptr);
+
+void write_padding(std::ostream &stream, size_t size);
+void write_block_index(std::ostream &stream, const std::vector<size_t> &offsets);
+const uint8_t *read_block_index(
+        std::vector<size_t> &offsets,
+        const uint8_t *begin,
+        const uint8_t *end);
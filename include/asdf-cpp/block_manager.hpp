@@ -1,76 +1,268 @@
 #pragma once
 
 #include <map>
+#include <tuple>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <deque>
 #include <vector>
 #include <memory>
+#include <future>
 #include <iostream>
 
 #include "block.hpp"
+#include "byteswap.hpp"
 #include "compression.hpp"
+#include "hyperslab.hpp"
+#include "shuffle.hpp"
+#include "thread_pool.hpp"
+
+
+/* Default bound on the data held in memory by parallel writes */
+#define DEFAULT_MAX_IN_FLIGHT   (1ul << 28)
 
 
 namespace Asdf {
 
+/*
+ * Determines when arrays share a block instead of each getting their own. By
+ * default, arrays that are created from the same buffer with the same
+ * compression and byte order share a block. Content deduplication also
+ * shares blocks between different buffers that hold the same data. Like the
+ * data itself, their contents are only compared when the file is written, so
+ * buffers may still change in between. Only buffers with the same size and
+ * encoding as another one are hashed.
+ */
+enum DedupMode
+{
+    no_dedup = 0,
+    dedup_identity,
+    dedup_content
+};
+
+/* A block that has been encoded in memory and is ready to be written */
+struct EncodedBlock
+{
+    block_header_t header;
+    std::vector<uint8_t> data;
+};
+
 class GenericBlock {
     public:
         GenericBlock(void) {}
         virtual ~GenericBlock() {};
+    protected:
+        /* Space allocated beyond the data, as a fraction of the data size */
+        double headroom = 0.0;
+        /* Whether the MD5 checksum of the data is recorded in the header */
+        bool checksum = true;
+
+        size_t allocation_for(size_t used_size) const
+        {
+            return used_size + (size_t) (used_size * headroom);
+        }
     private:
         friend class BlockManager;
 
-        virtual void write(std::ostream &ostream) const = 0;
+        /* Returns the number of bytes written, including the header */
+        virtual size_t write(std::ostream &ostream) const = 0;
+        virtual void encode(EncodedBlock &encoded) const = 0;
+        virtual bool is_compressed(void) const = 0;
+        virtual size_t get_data_size(void) const = 0;
         virtual void write_header(
                 std::ostream &ostream,
                 size_t data_size,
-                size_t actual_size) const = 0;
+                size_t actual_size,
+                const uint8_t *digest) const = 0;
 };
 
 template <typename T>
 class Block : public GenericBlock {
 
     public:
-        Block(T *buff, size_t length, CompressionType compression) : GenericBlock()
+        Block(T *buff, size_t length, CompressionOptions compression) :
+            GenericBlock()
         {
             this->buff = buff;
             this->length = length;
             this->compression = compression;
         }
 
-    private:
+    protected:
         friend class BlockManager;
 
-        void write(std::ostream &ostream) const
+        size_t write(std::ostream &ostream) const
         {
-            if (compression == CompressionType::none)
+            return write_data(ostream, buff);
+        }
+
+        /* Writes the given buffer, which holds length elements, as a block */
+        size_t write_data(std::ostream &ostream, const T *data) const
+        {
+            if (compression.type == CompressionType::none)
             {
                 size_t data_size = sizeof(T) * length;
 
-                write_header(ostream, data_size, data_size);
-                ostream.write((char *) buff, data_size);
+                const size_t allocated_size = allocation_for(data_size);
+
+                /*
+                 * The checksum belongs in the header, which comes first. If
+                 * the stream can seek, the data is hashed as it is written and
+                 * the header is rewritten afterwards. Otherwise the checksum
+                 * takes a separate pass.
+                 */
+                const std::streampos header_start_pos =
+                    checksum ? ostream.tellp() : std::streampos(-1);
+                const bool rewrite_header =
+                    header_start_pos != std::streampos(-1);
+
+                uint8_t digest[16] = { 0 };
+                if (checksum && not rewrite_header)
+                {
+                    compute_filtered_checksum(digest, (const uint8_t *) data,
+                                              data_size, swap_filter());
+                }
+
+                write_header(ostream, data_size, data_size, digest);
+                write_filtered_data(ostream, (const uint8_t *) data, data_size,
+                                    swap_filter(),
+                                    rewrite_header ? digest : nullptr);
+                write_padding(ostream, allocated_size - data_size);
+
+                if (rewrite_header)
+                {
+                    const std::streampos end_block_pos = ostream.tellp();
+
+                    ostream.seekp(header_start_pos);
+                    write_header(ostream, data_size, data_size, digest);
+                    ostream.seekp(end_block_pos);
+                }
+
+                return sizeof(block_header_t) + allocated_size;
             }
-            else
+
+            std::vector<uint8_t> filtered;
+            const T *input = filter_data(data, filtered);
+
+            /* A filtered copy is already in the right byte order */
+            return write_compressed_data(ostream, input,
+                    filtered.empty() ? swap_filter() : InputFilter());
+        }
+
+        /*
+         * Returns a filter that byteswaps the data on its way out when the
+         * block is written in the opposite byte order, or an empty one.
+         */
+        InputFilter swap_filter(void) const
+        {
+            if (not swap)
             {
-                write_compressed_data(ostream);
+                return InputFilter();
             }
+
+            return [](uint8_t *dst, const uint8_t *src, size_t size)
+            {
+                byteswap_copy(dst, src, size / sizeof(T), sizeof(T));
+            };
         }
 
-        void write_header(std::ostream &ostream, size_t data_size, size_t storage_size) const
+        /*
+         * Applies the shuffle filter, if any, to data that is about to be
+         * compressed. Returns either the filtered copy or the data itself.
+         * Uncompressed blocks are never filtered.
+         */
+        const T *filter_data(const T *data, std::vector<uint8_t> &filtered) const
+        {
+            if (compression.type == CompressionType::none ||
+                compression.shuffle == no_shuffle)
+            {
+                return data;
+            }
+
+            filtered.resize(sizeof(T) * length);
+            shuffle_data(filtered.data(), (const uint8_t *) data, length,
+                         sizeof(T), compression.shuffle);
+
+            /*
+             * Shuffling swapped data gives the same byte planes in reverse
+             * order, so they can be swapped here without another copy.
+             */
+            for (size_t i = 0; swap && i < sizeof(T) / 2; i++)
+            {
+                auto plane = filtered.begin() + i * length;
+                auto mirror = filtered.begin() + (sizeof(T) - 1 - i) * length;
+                std::swap_ranges(plane, plane + length, mirror);
+            }
+
+            return (const T *) filtered.data();
+        }
+
+        bool is_compressed(void) const
+        {
+            return compression.type != CompressionType::none;
+        }
+
+        size_t get_data_size(void) const
+        {
+            return sizeof(T) * length;
+        }
+
+        void encode(EncodedBlock &encoded) const
+        {
+            encode_data(encoded, buff);
+        }
+
+        /* Compresses the given buffer into memory instead of to a stream */
+        void encode_data(EncodedBlock &encoded, const T *data) const
+        {
+            const size_t input_size = sizeof(T) * length;
+
+            uint8_t digest[16] = { 0 };
+
+            std::vector<uint8_t> filtered;
+            data = filter_data(data, filtered);
+
+            compress_block_data(encoded.data, (const uint8_t *) data,
+                                input_size, compression,
+                                checksum ? digest : nullptr,
+                                filtered.empty() ? swap_filter() : InputFilter());
+            encoded.header = make_header(input_size, encoded.data.size(),
+                                         digest);
+        }
+
+        block_header_t make_header(size_t data_size, size_t storage_size,
+                                   const uint8_t *digest = nullptr) const
         {
             block_header_t header = {};
 
+            if (digest != nullptr)
+            {
+                memcpy(header.checksum, digest, sizeof(header.checksum));
+            }
+
             header.set_header_size(header_size);
 
-            header.set_compression(compression);
+            header.set_compression(compression.type);
 
-            /* For now these are all the same */
-            header.set_allocated_size(storage_size);
+            /* Headroom lets the block grow later without moving the rest */
+            header.set_allocated_size(allocation_for(storage_size));
             header.set_used_size(storage_size);
             header.set_data_size(data_size);
 
+            return header;
+        }
+
+        void write_header(std::ostream &ostream, size_t data_size,
+                          size_t storage_size,
+                          const uint8_t *digest = nullptr) const
+        {
+            block_header_t header = make_header(data_size, storage_size, digest);
             ostream.write((char *) &header, sizeof(header));
         }
 
-        void write_compressed_data(std::ostream &ostream) const
+        size_t write_compressed_data(std::ostream &ostream, const T *data,
+                                     const InputFilter &filter) const
         {
             const size_t input_size = sizeof(T) * length;
             size_t output_size = 0;
@@ -83,36 +275,219 @@ class Block : public GenericBlock {
              */
             write_header(ostream, input_size, 0);
 
+            /* The checksum is computed as the compressed data goes out */
+            uint8_t digest[16] = { 0 };
             write_compressed_block(
                     ostream,
                     &output_size,
-                    (const uint8_t *) this->buff,
+                    (const uint8_t *) data,
                     input_size,
-                    compression);
+                    compression,
+                    checksum ? digest : nullptr,
+                    filter);
+
+            const size_t allocated_size = allocation_for(output_size);
+            write_padding(ostream, allocated_size - output_size);
 
             const size_t end_block_pos = ostream.tellp();
 
             /* Now that the compressed size is known, rewrite the header */
             ostream.seekp(header_start_pos);
-            write_header(ostream, input_size, output_size);
+            write_header(ostream, input_size, output_size, digest);
             ostream.seekp(end_block_pos);
+
+            return sizeof(block_header_t) + allocated_size;
         }
 
-    private:
         T *buff = nullptr;
         size_t length = 0;
-        CompressionType compression = CompressionType::none;
+        CompressionOptions compression;
+        /* Whether the data is stored in the opposite of the native byte order */
+        bool swap = false;
+};
+
+/*
+ * A block that holds a single chunk of a larger array. The chunk is gathered
+ * out of the full array into a temporary buffer only when it is written, so
+ * the memory overhead is bounded by the chunk size.
+ */
+template <typename T>
+class ChunkBlock : public Block<T> {
+
+    public:
+        ChunkBlock(T *array, std::vector<size_t> shape,
+                   std::vector<size_t> origin, std::vector<size_t> extent,
+                   CompressionOptions compression) :
+            Block<T>(array, count_elements(extent), compression)
+        {
+            this->shape = shape;
+            this->origin = origin;
+            this->extent = extent;
+        }
+
+    private:
+        friend class BlockManager;
+
+        std::vector<size_t> shape;
+        std::vector<size_t> origin;
+        std::vector<size_t> extent;
+
+        static size_t count_elements(const std::vector<size_t> &extent)
+        {
+            size_t count = 1;
+            for (auto n : extent)
+            {
+                count *= n;
+            }
+
+            return count;
+        }
+
+        std::vector<T> gather(void) const
+        {
+            std::vector<T> chunk(this->length);
+
+            copy_hyperslab(
+                    (uint8_t *) chunk.data(), extent,
+                    std::vector<size_t>(extent.size(), 0),
+                    (const uint8_t *) this->buff, shape, origin,
+                    extent, sizeof(T));
+
+            return chunk;
+        }
+
+        size_t write(std::ostream &ostream) const
+        {
+            return this->write_data(ostream, gather().data());
+        }
+
+        void encode(EncodedBlock &encoded) const
+        {
+            this->encode_data(encoded, gather().data());
+        }
 };
 
 class BlockManager {
 
     public:
-        void write_blocks(std::ostream &ostream) const
+        /*
+         * Writes all of the blocks followed by the block index. The offset is
+         * the position of the first block relative to the start of the file,
+         * which is what the offsets in the index are relative to.
+         */
+        void write_blocks(std::ostream &ostream, size_t offset,
+                          const std::vector<int> &duplicates,
+                          bool seekable = true) const
         {
-            for (auto b : blocks)
+            std::vector<size_t> offsets = existing_offsets;
+
+            for (size_t i = 0; i < blocks.size(); i++)
+            {
+                /* Duplicates are written once, where they first occur */
+                if (duplicates[i] != (int) i)
+                {
+                    continue;
+                }
+
+                auto b = blocks[i];
+                offsets.push_back(offset);
+
+                /*
+                 * Compressed blocks are normally streamed out and then their
+                 * header is patched, which requires seeking. Otherwise the
+                 * block is compressed into memory first.
+                 */
+                if (not seekable and b->is_compressed())
+                {
+                    EncodedBlock encoded;
+                    b->encode(encoded);
+                    offset += write_encoded(ostream, encoded);
+                }
+                else
+                {
+                    offset += b->write(ostream);
+                }
+            }
+
+            finish_blocks(ostream, offsets);
+        }
+
+        /*
+         * Same as above, but compressed blocks are compressed concurrently on
+         * the given pool into staging buffers, which are then written out in
+         * order. Compressed blocks never seek, so this works with any output
+         * stream. Compression runs ahead of the writer only as long as the
+         * uncompressed size of the blocks in flight stays below max_in_flight
+         * (although at least one block is always in flight).
+         */
+        void write_blocks(std::ostream &ostream, size_t offset,
+                          const std::vector<int> &duplicates,
+                          ThreadPool &pool, size_t max_in_flight) const
+        {
+            typedef std::shared_ptr<EncodedBlock> encoded_ptr;
+
+            std::vector<size_t> offsets = existing_offsets;
+            std::deque<std::future<encoded_ptr>> pending;
+            size_t next = 0;
+            size_t in_flight = 0;
+
+            try
+            {
+                for (size_t i = 0; i < blocks.size(); i++)
+                {
+                    /* Keep the pool busy with the blocks that come next */
+                    while (next < blocks.size() and
+                           (next == i or in_flight < max_in_flight))
+                    {
+                        const size_t n = next++;
+                        auto block = blocks[n];
+                        if (duplicates[n] != (int) n or
+                            not block->is_compressed())
+                        {
+                            continue;
+                        }
+
+                        in_flight += block->get_data_size();
+                        pending.push_back(pool.submit([block]() {
+                            auto encoded = std::make_shared<EncodedBlock>();
+                            block->encode(*encoded);
+                            return encoded;
+                        }));
+                    }
+
+                    if (duplicates[i] != (int) i)
+                    {
+                        continue;
+                    }
+
+                    offsets.push_back(offset);
+
+                    auto block = blocks[i];
+                    if (not block->is_compressed())
+                    {
+                        offset += block->write(ostream);
+                        continue;
+                    }
+
+                    encoded_ptr encoded = pending.front().get();
+                    pending.pop_front();
+                    in_flight -= block->get_data_size();
+
+                    offset += write_encoded(ostream, *encoded);
+                }
+            }
+            catch (...)
             {
-                b->write(ostream);
+                /* Don't leave any tasks running that refer to the data */
+                for (auto &future : pending)
+                {
+                    future.wait();
+                }
+
+                throw;
             }
+
+            finish_blocks(ostream, offsets);
         }
 
         int get_length()
@@ -120,17 +495,353 @@ class BlockManager {
             return blocks.size();
         }
 
+        /* Enables or disables recording checksums for all blocks */
+        void set_checksums(bool enable)
+        {
+            block_checksums = enable;
+            for (auto b : blocks)
+            {
+                b->checksum = enable;
+            }
+        }
+
+        /* Upper bound on the size of the blocks, assuming no compression */
+        size_t get_storage_size(void) const
+        {
+            size_t size = 0;
+            for (auto b : blocks)
+            {
+                size += sizeof(block_header_t) +
+                    b->allocation_for(b->get_data_size());
+            }
+
+            return size;
+        }
+
+        /*
+         * Declares the blocks that are already present in the file when new
+         * blocks are appended to it. The sources of new blocks are numbered
+         * after them, and the block index covers both. Any blocks that were
+         * added before are discarded.
+         */
+        void set_existing_blocks(std::vector<size_t> offsets)
+        {
+            existing_offsets = offsets;
+            blocks.clear();
+            shared_blocks.clear();
+            content_candidates.clear();
+            streamed = false;
+        }
+
+        /*
+         * Sets the space allocated for each block beyond its data, as a
+         * fraction of the data size. This applies to all blocks, including
+         * those that were already added.
+         */
+        void set_block_headroom(double headroom)
+        {
+            block_headroom = headroom;
+            for (auto b : blocks)
+            {
+                b->headroom = headroom;
+            }
+        }
+
+        /*
+         * Reserves a streamed block after all of the other blocks. Its data
+         * is appended after the file is written, so it can only be referred
+         * to with a source of -1.
+         */
+        void add_streamed_block(void)
+        {
+            if (streamed)
+            {
+                throw std::runtime_error(
+                    "A file can contain at most one streamed array");
+            }
+
+            streamed = true;
+        }
+
+        bool has_streamed_block(void) const
+        {
+            return streamed;
+        }
+
+        /*
+         * Sets which blocks are shared between arrays that are added from now
+         * on (see DedupMode). Only arrays that are stored in a single block
+         * are deduplicated.
+         */
+        void set_dedup(DedupMode mode)
+        {
+            dedup = mode;
+        }
+
         template <typename T> int
-            add_data_block(T *data, size_t length, CompressionType compression)
+            add_data_block(T *data, size_t length, CompressionOptions compression,
+                           bool swap = false)
         {
-            int source_idx = blocks.size();
+            const size_t size = length * sizeof(T);
+            BlockKey key = make_key(data, size, sizeof(T), compression, swap);
+
+            if (dedup != no_dedup)
+            {
+                auto found = shared_blocks.find(key);
+                if (found != shared_blocks.end())
+                {
+                    return found->second;
+                }
+            }
+
+            int source_idx = existing_offsets.size() + blocks.size();
             auto block = new Block<T>(data, length, compression);
+            block->swap = swap;
+            block->headroom = block_headroom;
+            block->checksum = block_checksums;
             blocks.push_back(std::shared_ptr<GenericBlock>(dynamic_cast<GenericBlock*>(block)));
+
+            if (dedup != no_dedup)
+            {
+                shared_blocks[key] = source_idx;
+            }
+
+            /* The contents are compared when the file is written */
+            if (dedup == dedup_content)
+            {
+                ContentCandidate candidate = { blocks.size() - 1, key };
+                content_candidates.push_back(candidate);
+            }
+
             return source_idx;
         }
 
+        /*
+         * Finds the blocks whose data is identical to that of an earlier block
+         * with the same encoding. Returns the index of that earlier block for
+         * each block, or the block's own index if it is unique. Candidates are
+         * grouped by size and encoding first, so only buffers that could match
+         * are hashed, and equal digests are confirmed by comparing the data.
+         */
+        std::vector<int> find_duplicates(void) const
+        {
+            std::vector<int> duplicates(blocks.size());
+            for (size_t i = 0; i < blocks.size(); i++)
+            {
+                duplicates[i] = i;
+            }
+
+            std::map<BlockKey, std::vector<const ContentCandidate *>> groups;
+            for (auto &candidate : content_candidates)
+            {
+                BlockKey encoding = candidate.key;
+                encoding.data = nullptr;
+                groups[encoding].push_back(&candidate);
+            }
+
+            for (auto &group : groups)
+            {
+                if (group.second.size() < 2)
+                {
+                    continue;
+                }
+
+                std::map<std::string, std::vector<const ContentCandidate *>> kept;
+                for (auto candidate : group.second)
+                {
+                    const BlockKey &key = candidate->key;
+
+                    uint8_t digest[16];
+                    compute_checksum(digest, (const uint8_t *) key.data,
+                                     key.size);
+
+                    auto &matches = kept[std::string((const char *) digest,
+                                                     sizeof(digest))];
+                    bool found = false;
+                    for (auto match : matches)
+                    {
+                        if (memcmp(match->key.data, key.data, key.size) == 0)
+                        {
+                            duplicates[candidate->index] = match->index;
+                            found = true;
+                            break;
+                        }
+                    }
+
+                    if (not found)
+                    {
+                        matches.push_back(candidate);
+                    }
+                }
+            }
+
+            return duplicates;
+        }
+
+        /*
+         * Maps the source of each block, as handed out when it was added, to
+         * its source in a file where duplicates are left out.
+         */
+        std::vector<int> map_sources(const std::vector<int> &duplicates) const
+        {
+            std::vector<int> sources;
+            for (size_t i = 0; i < existing_offsets.size(); i++)
+            {
+                sources.push_back(i);
+            }
+
+            int next = existing_offsets.size();
+            for (size_t i = 0; i < blocks.size(); i++)
+            {
+                if (duplicates[i] == (int) i)
+                {
+                    sources.push_back(next++);
+                }
+                else
+                {
+                    sources.push_back(sources[existing_offsets.size() +
+                                              duplicates[i]]);
+                }
+            }
+
+            return sources;
+        }
+
+        /*
+         * Adds one block for each chunk of the given array. Returns the block
+         * sources in the row-major order of the chunk grid.
+         */
+        template <typename T> std::vector<int>
+            add_chunked_data_blocks(T *data, std::vector<size_t> shape,
+                                    std::vector<size_t> chunk_shape,
+                                    CompressionOptions compression,
+                                    bool swap = false)
+        {
+            ChunkGrid grid(shape, chunk_shape);
+            std::vector<int> sources;
+
+            for (size_t i = 0; i < grid.get_num_chunks(); i++)
+            {
+                sources.push_back(existing_offsets.size() + blocks.size());
+                auto block = new ChunkBlock<T>(data, shape,
+                        grid.chunk_origin(i), grid.chunk_extent(i),
+                        compression);
+                block->swap = swap;
+                block->headroom = block_headroom;
+                block->checksum = block_checksums;
+                blocks.push_back(std::shared_ptr<GenericBlock>(block));
+            }
+
+            return sources;
+        }
+
     private:
         std::vector<std::shared_ptr<GenericBlock>> blocks;
+        bool streamed = false;
+        double block_headroom = 0.0;
+        bool block_checksums = true;
+        DedupMode dedup = dedup_identity;
+
+        /*
+         * Identifies the data of a block by the buffer it comes from. Blocks
+         * are only shared if they are also encoded the same way.
+         */
+        struct BlockKey
+        {
+            const void *data;
+            size_t size;
+            size_t elem_size;
+            bool swap;
+            int type;
+            int level;
+            int strategy;
+            size_t buffer_size;
+            int shuffle;
+
+            bool operator<(const BlockKey &other) const
+            {
+                return std::tie(data, size, elem_size, swap, type,
+                                level, strategy, buffer_size, shuffle) <
+                       std::tie(other.data, other.size,
+                                other.elem_size, other.swap, other.type,
+                                other.level, other.strategy, other.buffer_size,
+                                other.shuffle);
+            }
+        };
+
+        /* Sources of the blocks that were added, by buffer and encoding */
+        std::map<BlockKey, int> shared_blocks;
+
+        /* Blocks that may be replaced by an identical one at write time */
+        struct ContentCandidate
+        {
+            size_t index;
+            BlockKey key;
+        };
+
+        std::vector<ContentCandidate> content_candidates;
+
+        static BlockKey make_key(const void *data, size_t size,
+                                 size_t elem_size,
+                                 const CompressionOptions &compression,
+                                 bool swap)
+        {
+            BlockKey key;
+            key.data = data;
+            key.size = size;
+            key.elem_size = elem_size;
+            key.swap = swap;
+            key.type = compression.type;
+            key.level = compression.level;
+            key.strategy = compression.strategy;
+            key.buffer_size = compression.buffer_size;
+
+            /* The filter is only applied to data that is compressed */
+            key.shuffle = (compression.type == CompressionType::none) ?
+                          no_shuffle : compression.shuffle;
+
+            return key;
+        }
+
+        /* Offsets of the blocks in the file that new blocks are appended to */
+        std::vector<size_t> existing_offsets;
+
+        /*
+         * A streamed block must come last and extends to the end of the
+         * file, so there can't be a block index after it.
+         */
+        void finish_blocks(std::ostream &ostream,
+                           const std::vector<size_t> &offsets) const
+        {
+            if (streamed)
+            {
+                block_header_t header = {};
+                header.set_header_size(header_size);
+                header.set_flags(BLOCK_FLAG_STREAMED);
+                header.set_compression(CompressionType::none);
+                header.set_allocated_size(0);
+                header.set_used_size(0);
+                header.set_data_size(0);
+
+                ostream.write((const char *) &header, sizeof(header));
+            }
+            else if (not offsets.empty())
+            {
+                write_block_index(ostream, offsets);
+            }
+        }
+
+        static size_t write_encoded(std::ostream &ostream,
+                                    const EncodedBlock &encoded)
+        {
+            ostream.write((const char *) &encoded.header, sizeof(encoded.header));
+            ostream.write((const char *) encoded.data.data(), encoded.data.size());
+
+            const size_t allocated_size = encoded.header.get_allocated_size();
+            write_padding(ostream, allocated_size - encoded.data.size());
+
+            return sizeof(encoded.header) + allocated_size;
+        }
 };
 
 }
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <cstdlib>
+#include <cstdint>
 #include <type_traits>
 
+#include "thread_pool.hpp"
+
 #define bswap_16(value) \
     ((((value) & 0xff) << 8) | ((value) >> 8))
 
@@ -15,42 +18,44 @@
     (uint64_t)bswap_32((uint32_t)((value) >> 32)))
 
 
+/* The byte order in which the data of an array is stored */
+typedef enum _ByteOrder
+{
+    native_byte_order = 0,
+    little_endian,
+    big_endian,
+} ByteOrder;
+
+
 template <typename T>
 typename std::enable_if<(sizeof(T) == 1), void>::type
-byteswap_data(T *data, size_t count)
+byteswap_data(T *data, size_t count, Asdf::ThreadPool *pool = nullptr)
 {
     /* NOP -- covers corner case */
 }
 
-template <typename T>
-typename std::enable_if<(sizeof(T) == 2), void>::type
-byteswap_data(T *data, size_t count)
-{
-    /* This loop could be parallelized with OpenMP */
-    for (size_t i = 0; i < count; i++)
-    {
-        data[i] = bswap_16(data[i]);
-    }
-}
+/*
+ * Reverses the byte order of count elements of elem_size (2, 4 or 8) bytes.
+ * On x86 this uses SSSE3, AVX2 or AVX-512 kernels depending on what the CPU
+ * supports. If a pool is given, large buffers are split between the calling
+ * thread and the workers of the pool, unless the caller is a worker itself.
+ */
+void byteswap_buffer(void *data, size_t count, size_t elem_size,
+                     Asdf::ThreadPool *pool = nullptr);
+
+/*
+ * Same as above, but the swapped elements are written to dst instead. The
+ * buffers must either be the same or not overlap at all.
+ */
+void byteswap_copy(void *dst, const void *src, size_t count, size_t elem_size,
+                   Asdf::ThreadPool *pool = nullptr);
 
-template <typename T>
-typename std::enable_if<(sizeof(T) == 4), void>::type
-byteswap_data(T *data, size_t count)
-{
-    /* This loop could be parallelized with OpenMP */
-    for (size_t i = 0; i < count; i++)
-    {
-        data[i] = bswap_32(data[i]);
-    }
-}
 
 template <typename T>
-typename std::enable_if<(sizeof(T) == 8), void>::type
-byteswap_data(T *data, size_t count)
+typename std::enable_if<(sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8),
+                        void>::type
+byteswap_data(T *data, size_t count, Asdf::ThreadPool *pool = nullptr)
 {
-    /* This loop could be parallelized with OpenMP */
-    for (size_t i = 0; i < count; i++)
-    {
-        data[i] = bswap_64(data[i]);
-    }
+    /* Swap the integer representation so this also works for floats */
+    byteswap_buffer(data, count, sizeof(T), pool);
 }
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <string>
+#include <climits>
+#include <cstdlib>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
 
 
 typedef enum _CompressionType
@@ -9,6 +14,8 @@ typedef enum _CompressionType
     bzip2,
     none,
     unknown,
+    zstd,
+    lz4,
 } CompressionType;
 
 
@@ -20,6 +27,10 @@ std::string inline CompressionType_to_string(CompressionType ct)
             return "zlib";
         case bzip2:
             return "bzip2";
+        case zstd:
+            return "zstd";
+        case lz4:
+            return "lz4";
         case none:
             return "none";
         default:
@@ -28,3 +39,111 @@ std::string inline CompressionType_to_string(CompressionType ct)
 
     return "unknown";
 }
+
+/*
+ * Filters that rearrange the bytes of an array before it is compressed. Byte
+ * shuffling groups the first byte of every element together, then the second
+ * byte and so on, which makes the slowly varying bytes of numeric data (e.g.
+ * the sign and exponent of floats) much easier to compress. Bit shuffling
+ * does the same for each bit. The filter is recorded in the tree, since the
+ * block on its own does not say how large the elements are.
+ */
+typedef enum _ShuffleType
+{
+    no_shuffle = 0,
+    byte_shuffle,
+    bit_shuffle,
+} ShuffleType;
+
+
+std::string inline ShuffleType_to_string(ShuffleType st)
+{
+    switch (st)
+    {
+        case byte_shuffle:
+            return "byte";
+        case bit_shuffle:
+            return "bit";
+        default:
+            break;
+    }
+
+    return "none";
+}
+
+ShuffleType inline ShuffleType_from_string(std::string name)
+{
+    if (name == "byte")
+    {
+        return byte_shuffle;
+    }
+    else if (name == "bit")
+    {
+        return bit_shuffle;
+    }
+    else if (name == "none")
+    {
+        return no_shuffle;
+    }
+
+    throw std::runtime_error("Unknown shuffle filter: " + name);
+}
+
+/* Selects the default compression level of each codec */
+#define COMPRESSION_LEVEL_DEFAULT       INT_MIN
+
+/*
+ * Size of the scratch buffer that compressed output passes through on its
+ * way to the file. This is fairly arbitrary and can be tuned per array.
+ */
+#define DEFAULT_COMPRESSION_BUFFER_SIZE (1ul << 16)
+
+
+/*
+ * Describes how an array is compressed. This converts implicitly from a
+ * CompressionType, in which case the codec's defaults are used.
+ *
+ * The meaning of level and strategy depends on the codec:
+ *   zlib:  level 0-9, strategy is e.g. Z_FILTERED or Z_RLE
+ *   bzip2: level is the block size in units of 100k (1-9)
+ *   zstd:  level as for the zstd tool, strategy is a ZSTD_strategy value
+ *   lz4:   level is the acceleration factor, where higher is faster
+ * A strategy of 0 selects the codec's default. The buffer size must not be
+ * zero. The shuffle filter is only applied when the array is actually
+ * compressed.
+ */
+struct CompressionOptions
+{
+    CompressionType type;
+    int level;
+    int strategy;
+    size_t buffer_size;
+    ShuffleType shuffle;
+
+    CompressionOptions(CompressionType type = none,
+                       int level = COMPRESSION_LEVEL_DEFAULT,
+                       int strategy = 0,
+                       size_t buffer_size = DEFAULT_COMPRESSION_BUFFER_SIZE,
+                       ShuffleType shuffle = no_shuffle) :
+        type(type), level(level), strategy(strategy), buffer_size(buffer_size),
+        shuffle(shuffle)
+    {
+    }
+};
+
+/*
+ * Receives a window of decoded block data, along with the offset of the
+ * window within the data.
+ */
+typedef std::function<void(const uint8_t *window, size_t offset, size_t size)>
+    WindowConsumer;
+
+/*
+ * Transforms a window of data on its way to the compressor or the file, e.g.
+ * to change its byte order, and writes the result to dst.
+ */
+typedef std::function<void(uint8_t *dst, const uint8_t *src, size_t size)>
+    InputFilter;
+
+/* Indicates whether the library was built with support for the codec */
+bool is_compression_supported(CompressionType ct);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "datatypes.hpp"
+
+
+namespace Asdf {
+
+/*
+ * Converts count elements of src_type to dst_type, following the usual C++
+ * conversion rules; in particular any nonzero value becomes true when the
+ * destination is bool8. Floating point values that are out of range for an
+ * integer destination saturate to its lowest or highest value, and NaN
+ * becomes zero. If swap is set, the source elements are byteswapped
+ * first. This is done a small tile at a time, so the source is only read
+ * once and the destination is the only buffer that gets written to memory.
+ * The source and destination must not overlap unless the types are equal.
+ *
+ * Common conversions to and between floating point types, as well as the
+ * conversion of single byte types to bool8, use AVX2 kernels on x86 when the
+ * CPU supports them.
+ */
+void convert_data(void *dst, DType dst_type, const void *src, DType src_type,
+                  size_t count, bool swap = false);
+
+} /* namespace Asdf */
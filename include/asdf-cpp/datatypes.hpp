@@ -2,11 +2,105 @@
 
 #include <string>
 #include <cstdint>
+#include <cstdlib>
 #include <climits>
 #include <assert.h>
 
 
-#define DECLARE_DTYPE_FUNCTIONS(TYPE, STRING)           \
+/* The scalar datatypes that arrays can hold */
+typedef enum _DType
+{
+    int8_dtype = 0,
+    int16_dtype,
+    int32_dtype,
+    int64_dtype,
+    uint8_dtype,
+    uint16_dtype,
+    uint32_dtype,
+    uint64_dtype,
+    float32_dtype,
+    float64_dtype,
+    bool8_dtype,
+    unknown_dtype,
+} DType;
+
+
+std::string inline DType_to_string(DType dtype)
+{
+    switch (dtype)
+    {
+        case int8_dtype:
+            return "int8";
+        case int16_dtype:
+            return "int16";
+        case int32_dtype:
+            return "int32";
+        case int64_dtype:
+            return "int64";
+        case uint8_dtype:
+            return "uint8";
+        case uint16_dtype:
+            return "uint16";
+        case uint32_dtype:
+            return "uint32";
+        case uint64_dtype:
+            return "uint64";
+        case float32_dtype:
+            return "float32";
+        case float64_dtype:
+            return "float64";
+        case bool8_dtype:
+            return "bool8";
+        default:
+            break;
+    }
+
+    return "unknown";
+}
+
+/* Datatypes that are not listed above map to unknown_dtype */
+DType inline DType_from_string(std::string name)
+{
+    for (int i = 0; i < unknown_dtype; i++)
+    {
+        if (name == DType_to_string((DType) i))
+        {
+            return (DType) i;
+        }
+    }
+
+    return unknown_dtype;
+}
+
+/* Size of a single element in bytes, or 0 for unknown datatypes */
+size_t inline DType_size(DType dtype)
+{
+    switch (dtype)
+    {
+        case int8_dtype:
+        case uint8_dtype:
+        case bool8_dtype:
+            return 1;
+        case int16_dtype:
+        case uint16_dtype:
+            return 2;
+        case int32_dtype:
+        case uint32_dtype:
+        case float32_dtype:
+            return 4;
+        case int64_dtype:
+        case uint64_dtype:
+        case float64_dtype:
+            return 8;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+
+#define DECLARE_DTYPE_FUNCTIONS(TYPE, STRING, DTYPE)    \
     template <>                                         \
     inline std::string dtype_to_string<TYPE>()          \
     {                                                   \
@@ -17,31 +111,41 @@
     inline bool dtype_matches<TYPE>(std::string string) \
     {                                                   \
         return string == STRING;                        \
+    }                                                   \
+                                                        \
+    template <>                                         \
+    inline DType dtype_of<TYPE>()                       \
+    {                                                   \
+        return DTYPE;                                   \
     }
 
 
 template <typename T> std::string dtype_to_string(void);
 template <typename T> bool dtype_matches(std::string string);
+template <typename T> DType dtype_of(void);
 
-DECLARE_DTYPE_FUNCTIONS(char,       "int8");
+DECLARE_DTYPE_FUNCTIONS(char,       "int8",     int8_dtype);
 
-DECLARE_DTYPE_FUNCTIONS(int8_t,     "int8");
-DECLARE_DTYPE_FUNCTIONS(int16_t,    "int16");
-DECLARE_DTYPE_FUNCTIONS(int32_t,    "int32");
-DECLARE_DTYPE_FUNCTIONS(int64_t,    "int64");
+DECLARE_DTYPE_FUNCTIONS(int8_t,     "int8",     int8_dtype);
+DECLARE_DTYPE_FUNCTIONS(int16_t,    "int16",    int16_dtype);
+DECLARE_DTYPE_FUNCTIONS(int32_t,    "int32",    int32_dtype);
+DECLARE_DTYPE_FUNCTIONS(int64_t,    "int64",    int64_dtype);
 
-DECLARE_DTYPE_FUNCTIONS(uint8_t,    "uint8");
-DECLARE_DTYPE_FUNCTIONS(uint16_t,   "uint16");
-DECLARE_DTYPE_FUNCTIONS(uint32_t,   "uint32");
-DECLARE_DTYPE_FUNCTIONS(uint64_t,   "uint64");
+DECLARE_DTYPE_FUNCTIONS(uint8_t,    "uint8",    uint8_dtype);
+DECLARE_DTYPE_FUNCTIONS(uint16_t,   "uint16",   uint16_dtype);
+DECLARE_DTYPE_FUNCTIONS(uint32_t,   "uint32",   uint32_dtype);
+DECLARE_DTYPE_FUNCTIONS(uint64_t,   "uint64",   uint64_dtype);
 
 /* Sanity checks to ensure cross-platform consistency */
 static_assert(CHAR_BIT * sizeof(float) == 32, "Unexpected size for float datatype");
 static_assert(CHAR_BIT * sizeof(double) == 64, "Unexpected size for double datatype");
-DECLARE_DTYPE_FUNCTIONS(float,      "float32");
-DECLARE_DTYPE_FUNCTIONS(double,     "float64");
+DECLARE_DTYPE_FUNCTIONS(float,      "float32",  float32_dtype);
+DECLARE_DTYPE_FUNCTIONS(double,     "float64",  float64_dtype);
+
+static_assert(sizeof(bool) == 1, "Unexpected size for bool datatype");
+DECLARE_DTYPE_FUNCTIONS(bool,       "bool8",    bool8_dtype);
 
 #ifdef __clang__
 static_assert(CHAR_BIT * sizeof(long) == 64, "Unexpected size for long datatype");
-DECLARE_DTYPE_FUNCTIONS(long,       "int64");
+DECLARE_DTYPE_FUNCTIONS(long,       "int64",    int64_dtype);
 #endif
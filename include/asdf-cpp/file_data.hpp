@@ -0,0 +1,78 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <memory>
+
+#include <cstdint>
+#include <cstdlib>
+
+
+namespace Asdf {
+
+/* Determines whether the data of a file on disk may be modified in place */
+enum AccessMode
+{
+    read_only = 0,
+    read_write
+};
+
+/*
+ * Owns the raw contents of an ASDF file: either a memory map of the file on
+ * disk or a copy of the data read from a stream. It is shared between an
+ * AsdfFile and any array views that point into it, so the data stays valid
+ * for as long as any of them are alive.
+ */
+class FileData
+{
+    public:
+        FileData(std::string filename, AccessMode mode = read_only);
+        FileData(std::iostream &stream);
+        ~FileData(void);
+
+        FileData(const FileData &) = delete;
+        FileData& operator=(const FileData &) = delete;
+
+        uint8_t * get_data(void) const
+        {
+            return data;
+        }
+
+        size_t get_size(void) const
+        {
+            return size;
+        }
+
+        bool is_memmapped(void) const
+        {
+            return memmapped;
+        }
+
+        /* Indicates whether the memory map is shared and writable */
+        bool is_writable(void) const
+        {
+            return writable;
+        }
+
+        /*
+         * Writes modified pages in the given region of the memory map back
+         * to the file. Only the pages that overlap the region are synced.
+         */
+        void sync(size_t offset, size_t length) const;
+
+        /*
+         * Creates a private copy-on-write mapping of the given region of the
+         * file. Pages are only copied by the kernel once they are written to.
+         * Returns nullptr if the data is not memory mapped.
+         */
+        std::shared_ptr<uint8_t> map_private(size_t offset, size_t length) const;
+
+    private:
+        int fd = -1;
+        uint8_t *data = nullptr;
+        size_t size = 0;
+        bool memmapped = false;
+        bool writable = false;
+};
+
+} /* namespace Asdf */
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <streambuf>
+
+#include <cstdint>
+#include <cstdlib>
+
+
+/* Writes smaller than this are held back and gathered with the next one */
+#define FILE_WRITER_GATHER_SIZE     (1ul << 16)
+
+/* Alignment and staging buffer size used for O_DIRECT output */
+#define DIRECT_IO_ALIGNMENT         4096
+#define DIRECT_IO_BUFFER_SIZE       (1ul << 23)
+
+
+namespace Asdf {
+
+/*
+ * An output streambuf that writes straight to a file descriptor, bypassing
+ * the copy into an iostream buffer. Small writes such as block headers are
+ * held back and written together with the payload that follows them using a
+ * single writev call.
+ *
+ * With direct I/O, the file is opened with O_DIRECT so that the data does not
+ * pass through the page cache. Everything is then copied into an aligned
+ * staging buffer, and the output can't seek. If the file system does not
+ * support O_DIRECT, regular I/O is used instead.
+ */
+class FileWriter : public std::streambuf
+{
+    public:
+        FileWriter(std::string filename, bool direct_io = false);
+        ~FileWriter(void);
+
+        FileWriter(const FileWriter &) = delete;
+        FileWriter& operator=(const FileWriter &) = delete;
+
+        /*
+         * Asks the file system to allocate space for the expected size. Any
+         * part of it that isn't written is released again on close.
+         */
+        void reserve(size_t size);
+
+        /* Writes out any remaining data and closes the file */
+        void close(void);
+
+        bool is_direct(void) const
+        {
+            return direct;
+        }
+
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize n);
+        int_type overflow(int_type c);
+        int sync(void);
+
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                         std::ios_base::openmode which);
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+
+    private:
+        int fd = -1;
+        bool direct = false;
+
+        /* Logical position in the output and the furthest point written */
+        size_t position = 0;
+        size_t length = 0;
+
+        /* Whether space past the end of the data may have been allocated */
+        bool reserved = false;
+
+        std::vector<char> pending;
+
+        char *staging = nullptr;
+        size_t staged = 0;
+
+        void flush_pending(const char *extra = nullptr, size_t extra_size = 0);
+        void stage(const char *s, size_t n);
+        void write_staging(size_t size);
+};
+
+} /* namespace Asdf */
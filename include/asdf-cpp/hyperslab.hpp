@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+
+
+namespace Asdf {
+
+/*
+ * Copies an N-dimensional region of count elements from one row-major array
+ * to another. The start of the region is given separately for the source and
+ * the destination, so this can be used to gather a chunk out of a larger
+ * array or to scatter a chunk into one.
+ */
+void copy_hyperslab(
+        uint8_t *dst,
+        const std::vector<size_t> &dst_shape,
+        const std::vector<size_t> &dst_start,
+        const uint8_t *src,
+        const std::vector<size_t> &src_shape,
+        const std::vector<size_t> &src_start,
+        const std::vector<size_t> &count,
+        size_t element_size);
+
+/*
+ * Gathers the elements of a strided array into a contiguous row-major array.
+ * The source points to the element at index (0, 0, ...), and the strides are
+ * measured in bytes and may be negative.
+ */
+void copy_strided(
+        uint8_t *dst,
+        const uint8_t *src,
+        const std::vector<size_t> &shape,
+        const std::vector<ptrdiff_t> &strides,
+        size_t element_size);
+
+/*
+ * Describes the regular grid of chunks that covers a chunked array. Chunks
+ * are numbered in row-major order. Chunks along the upper edges of the array
+ * are truncated to the array bounds rather than padded.
+ */
+class ChunkGrid
+{
+    public:
+        ChunkGrid(std::vector<size_t> shape, std::vector<size_t> chunk_shape);
+
+        size_t get_num_chunks(void) const;
+        std::vector<size_t> chunk_origin(size_t index) const;
+        std::vector<size_t> chunk_extent(size_t index) const;
+
+        /* Returns the indices of all chunks that intersect the given region */
+        std::vector<size_t> find_chunks(
+                const std::vector<size_t> &start,
+                const std::vector<size_t> &count) const;
+
+    private:
+        std::vector<size_t> shape;
+        std::vector<size_t> chunk_shape;
+        std::vector<size_t> grid_shape;
+};
+
+} /* namespace Asdf */
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <yaml-cpp/yaml.h>
+
+#include "datatypes.hpp"
+
+
+namespace Asdf {
+
+/*
+ * Converts the elements of an array, in native byte order, to the nested
+ * sequences of an inline ndarray, with one level of nesting per dimension.
+ * Floating point values are written with enough digits to be read back
+ * exactly.
+ */
+YAML::Node encode_inline_data(const uint8_t *data, DType dtype,
+                              const std::vector<size_t> &shape);
+
+/*
+ * Parses the nested sequences of an inline ndarray into elements of the given
+ * datatype, in native byte order. Numbers are parsed straight from the text
+ * of each scalar, which is much faster than going through yaml-cpp's stream
+ * based conversions; those are only used for unusual notations. Throws if
+ * the number of elements does not match the shape.
+ */
+std::vector<uint8_t> decode_inline_data(const YAML::Node &data, DType dtype,
+                                        const std::vector<size_t> &shape);
+
+/* Determines the shape of inline data from the nesting of its sequences */
+std::vector<size_t> inline_data_shape(const YAML::Node &data);
+
+/*
+ * Picks a datatype for inline data that does not specify one: bool8 if all
+ * elements are booleans, int64 if they are all integers and float64 otherwise.
+ */
+DType infer_inline_dtype(const YAML::Node &data);
+
+} /* namespace Asdf */
@@ -7,12 +7,46 @@
 #include "../compression.hpp"
 
 
+/*
+ * Size of the windows that decompress_block_windows produces. This is small
+ * enough for each window to stay in cache while it is post-processed.
+ */
+#define DECOMPRESS_WINDOW_SIZE  (1ul << 18)
+
+/*
+ * Size of the staging buffer that filtered data passes through on its way to
+ * the compressor. This must be a multiple of the size of any element.
+ */
+#define FILTER_WINDOW_SIZE      (1ul << 18)
+
+
+/*
+ * The buffers that each thread keeps for itself (see thread_buffer). Data may
+ * pass through several of them at once, so each role has its own buffer.
+ */
+typedef enum _BufferRole
+{
+    scratch_role = 0,   /* Compressed output on its way to the file */
+    window_role,        /* Windows of decompressed data */
+    staging_role,       /* Filtered data on its way to a compressor */
+    filter_role,        /* Filtered data on its way to the file */
+    num_buffer_roles,
+} BufferRole;
+
+/*
+ * Returns this thread's buffer for the given role, grown to hold at least
+ * size bytes. The buffer is reused by the next call for the same role.
+ */
+uint8_t *thread_buffer(BufferRole role, size_t size);
+
+
 int compress_and_write_block(
         std::ostream &stream,
         size_t *output_size,
         const uint8_t *input,
         size_t input_size,
-        CompressionType compression);
+        const CompressionOptions &options,
+        const InputFilter &filter = InputFilter());
 
 int decompress_block(
         uint8_t *output,
@@ -20,3 +54,16 @@ int decompress_block(
         const uint8_t *input,
         size_t input_size,
         CompressionType compression);
+
+/*
+ * Decompresses a block a window at a time into a small buffer that is reused,
+ * and passes each window to consume as soon as it is complete. Every window
+ * is a multiple of alignment bytes in size, except possibly the last.
+ */
+int decompress_block_windows(
+        const uint8_t *input,
+        size_t input_size,
+        size_t output_size,
+        CompressionType compression,
+        size_t alignment,
+        const WindowConsumer &consume);
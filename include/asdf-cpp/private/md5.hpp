@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+
+namespace Asdf {
+
+/*
+ * Incremental MD5 implementation (RFC 1321), used for block checksums. Data
+ * can be fed in pieces as it is produced, so a block never has to be
+ * traversed a second time just to compute its checksum.
+ */
+class MD5
+{
+    public:
+        MD5(void);
+
+        void update(const void *data, size_t size);
+        void finish(uint8_t digest[16]);
+
+    private:
+        uint32_t state[4];
+        uint64_t length = 0;
+        uint8_t buffer[64];
+        size_t buffered = 0;
+
+        void transform(const uint8_t block[64]);
+};
+
+} /* namespace Asdf */
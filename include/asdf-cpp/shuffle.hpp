@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "compression.hpp"
+
+
+namespace Asdf {
+
+/*
+ * Applies a shuffle filter to count elements of elem_size bytes each. The
+ * source and destination must not overlap. Byte shuffling stores byte j of
+ * element i at dst[j * count + i]. Bit shuffling then transposes the bits of
+ * each of these byte planes in groups of eight elements, so that bit k of
+ * every byte in the group ends up in the same byte. Elements left over at the
+ * end of a plane are only byte shuffled.
+ *
+ * Element sizes of 2, 4, 8 and 16 bytes use SSE2 or AVX2 kernels on x86 for
+ * the byte shuffle, chosen at run time depending on the CPU. The bit transposes
+ * of the byte planes use them for all element sizes.
+ */
+void shuffle_data(uint8_t *dst, const uint8_t *src, size_t count,
+                  size_t elem_size, ShuffleType shuffle);
+
+/* Reverses shuffle_data */
+void unshuffle_data(uint8_t *dst, const uint8_t *src, size_t count,
+                    size_t elem_size, ShuffleType shuffle);
+
+} /* namespace Asdf */
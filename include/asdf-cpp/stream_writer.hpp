@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+
+/* Default amount of row data that is buffered before it is written out */
+#define DEFAULT_STREAM_BUFFER_SIZE  (1ul << 20)
+
+
+namespace Asdf {
+
+/*
+ * Appends rows to the streamed block at the end of an ASDF file. This is
+ * returned by AsdfFile::write_streamed once everything else in the file has
+ * been written. Rows are collected in a buffer of bounded size, so an array
+ * of any length can be recorded without holding it in memory. The stream is
+ * flushed when the writer is destroyed.
+ */
+template <typename T>
+class StreamWriter
+{
+    public:
+        StreamWriter(std::ostream &ostream, size_t row_size,
+                     size_t buffer_size = DEFAULT_STREAM_BUFFER_SIZE) :
+            ostream(ostream)
+        {
+            this->row_size = row_size;
+            this->buffer.reserve(std::max(buffer_size / sizeof(T), (size_t) 1));
+        }
+
+        StreamWriter(StreamWriter &&other) = default;
+
+        ~StreamWriter(void)
+        {
+            if (not buffer.empty())
+            {
+                flush();
+            }
+        }
+
+        /* Each row holds row_size elements, as given when creating the array */
+        void append(const T *rows, size_t num_rows)
+        {
+            const size_t count = num_rows * row_size;
+
+            if (buffer.size() + count > buffer.capacity())
+            {
+                write_buffer();
+            }
+
+            /* Rows that wouldn't fit in the buffer anyway skip it entirely */
+            if (count >= buffer.capacity())
+            {
+                ostream.write((const char *) rows, count * sizeof(T));
+            }
+            else
+            {
+                buffer.insert(buffer.end(), rows, rows + count);
+            }
+
+            this->num_rows += num_rows;
+        }
+
+        void flush(void)
+        {
+            write_buffer();
+            ostream.flush();
+        }
+
+        size_t get_num_rows(void) const
+        {
+            return num_rows;
+        }
+
+    private:
+        std::ostream &ostream;
+        std::vector<T> buffer;
+        size_t row_size = 1;
+        size_t num_rows = 0;
+
+        void write_buffer(void)
+        {
+            ostream.write((const char *) buffer.data(), buffer.size() * sizeof(T));
+            buffer.clear();
+        }
+};
+
+} /* namespace Asdf */
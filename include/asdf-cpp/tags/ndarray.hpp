@@ -1,6 +1,8 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <sstream>
 #include <type_traits>
 #include <yaml-cpp/yaml.h>
@@ -10,11 +12,36 @@
 #include "../compression.hpp"
 #include "../block.hpp"
 #include "../byteswap.hpp"
+#include "../file_data.hpp"
+#include "../array_view.hpp"
+#include "../hyperslab.hpp"
+#include "../shuffle.hpp"
+#include "../convert.hpp"
+#include "../inline_data.hpp"
+#include "../thread_pool.hpp"
 
 #define NDARRAY_TAG_BASE    "tag:stsci.edu:asdf/core/ndarray"
 #define NDARRAY_TAG_VERSION "1.0.0"
 #define NDARRAY_TAG         (NDARRAY_TAG_BASE "-" NDARRAY_TAG_VERSION)
 
+/*
+ * Chunked arrays are not part of the ASDF Standard, so they get their own
+ * tag. This keeps other ASDF implementations from misinterpreting them.
+ */
+#define CHUNKED_NDARRAY_TAG_BASE    "tag:asdf-format.org/asdf-cpp/chunked_ndarray"
+#define CHUNKED_NDARRAY_TAG_VERSION "1.0.0"
+#define CHUNKED_NDARRAY_TAG \
+    (CHUNKED_NDARRAY_TAG_BASE "-" CHUNKED_NDARRAY_TAG_VERSION)
+
+/*
+ * The same goes for arrays stored with a shuffle filter. Under the standard
+ * tag, other implementations would silently return the shuffled data.
+ */
+#define SHUFFLED_NDARRAY_TAG_BASE    "tag:asdf-format.org/asdf-cpp/shuffled_ndarray"
+#define SHUFFLED_NDARRAY_TAG_VERSION "1.0.0"
+#define SHUFFLED_NDARRAY_TAG \
+    (SHUFFLED_NDARRAY_TAG_BASE "-" SHUFFLED_NDARRAY_TAG_VERSION)
+
 #define CHECK_ARRAY_READABLE                                    \
     if (not read_allowed)                                       \
     {                                                           \
@@ -45,16 +72,39 @@ static inline std::string get_system_byte_order()
     return system_byte_order;
 }
 
+static inline std::string ByteOrder_to_string(ByteOrder order)
+{
+    switch (order)
+    {
+        case little_endian:
+            return "little";
+        case big_endian:
+            return "big";
+        default:
+            break;
+    }
+
+    return get_system_byte_order();
+}
+
 
 namespace Asdf {
 
 /* Forward declaration of AsdfFile */
 class AsdfFile;
 
-template <typename T>
-class NDArray
+/*
+ * A handle to an array whose datatype is only known at run time, from the
+ * tree. The data can be read as any of the supported element types, in which
+ * case it is converted as it is decompressed and byteswapped. NDArray builds
+ * on this for arrays whose element type is fixed at compile time.
+ */
+class GenericNDArray
 {
     public:
+        /* A handle that is not associated with any array */
+        GenericNDArray() { };
+
         int get_source() const
         {
             return source;
@@ -65,18 +115,85 @@ class NDArray
             return shape;
         }
 
-        T * get_raw_data(void)
+        /* Datatype of the elements as they are stored in the file */
+        DType get_dtype(void) const
         {
-            CHECK_ARRAY_READABLE;
+            return dtype;
+        }
 
-            const block_header_t *header = (const block_header_t *) block_ptr;
-            return  (T *)(block_ptr + header->total_header_size());
+        std::string get_datatype(void) const
+        {
+            return datatype;
+        }
+
+        bool is_chunked(void) const
+        {
+            return not chunk_shape.empty();
+        }
+
+        std::vector<size_t> get_chunk_shape(void) const
+        {
+            return chunk_shape;
+        }
+
+        /* Indicates whether the data is stored in the tree, not in a block */
+        bool is_inline(void) const
+        {
+            return inline_data != nullptr;
+        }
+
+        /*
+         * Offset of the first element within the data of the block, in bytes.
+         * Several arrays can share one block, e.g. when one is a view of
+         * another.
+         */
+        size_t get_offset(void) const
+        {
+            return offset;
+        }
+
+        /*
+         * Number of bytes between neighbouring elements along each dimension.
+         * Strides that are not given in the tree follow from the shape and
+         * the order of the array.
+         */
+        std::vector<ptrdiff_t> get_strides(void) const
+        {
+            if (not strides.empty())
+            {
+                return strides;
+            }
+
+            return contiguous_strides(shape, element_size(), order);
+        }
+
+        /* Either "C" for row-major or "F" for column-major order */
+        std::string get_order(void) const
+        {
+            return order;
+        }
+
+        /* Indicates whether the elements fill the block in row-major order */
+        bool has_default_layout(void) const
+        {
+            if (offset == 0 and strides.empty() and order == "C")
+            {
+                return true;
+            }
+
+            return offset == 0 and
+                   get_strides() == contiguous_strides(shape, element_size(), "C");
         }
 
         CompressionType get_compression_type(void) const
         {
             CHECK_ARRAY_READABLE;
 
+            if (is_inline())
+            {
+                return CompressionType::none;
+            }
+
             const block_header_t *header = (const block_header_t *) block_ptr;
             CompressionType ct = header->get_compression();
             if (ct == unknown)
@@ -92,153 +209,1121 @@ class NDArray
             return get_compression_type() != CompressionType::none;
         }
 
-        std::shared_ptr<T> read(void)
+        /* Returns the filter that was applied to the data before compression */
+        ShuffleType get_shuffle(void) const
+        {
+            return shuffle;
+        }
+
+        /* Returns the number of elements stored in the data block */
+        size_t get_num_elements(void) const
         {
             CHECK_ARRAY_READABLE;
 
-            const block_header_t *header = (const block_header_t *) block_ptr;
+            if (is_chunked() or is_inline() or not has_default_layout())
+            {
+                return count_elements(shape);
+            }
+
+            return get_data_bytes() / element_size();
+        }
+
+        /* Indicates whether the array is stored in a streamed block */
+        bool is_streamed(void) const
+        {
+            return streamed;
+        }
+
+        /*
+         * Reads the array data into a newly allocated buffer, converting each
+         * element to type U. The conversion happens a window at a time as the
+         * data is decompressed and byteswapped, so no intermediate copy of
+         * the whole array is made.
+         */
+        template <typename U>
+        std::shared_ptr<U> read_as(void) const
+        {
+            const size_t count = get_num_elements();
 
-            T *ptr = static_cast<T *>(process_block_data(block_ptr));
+            U *ptr = (U *) malloc(std::max(count, (size_t) 1) * sizeof(U));
+            if (ptr == nullptr)
+            {
+                throw std::runtime_error("Unable to allocate memory for array data");
+            }
+
+            /* The buffer comes from malloc, so it must be released with free */
+            std::shared_ptr<U> buffer(ptr, [](U *p) { free(p); });
+            read_into_as<U>(ptr, count);
+
+            return buffer;
+        }
+
+        /*
+         * Same as read_as, but the data is stored in a buffer provided by the
+         * caller, which can hold up to capacity elements. Returns the number
+         * of elements that were read.
+         */
+        template <typename U>
+        size_t read_into_as(U *dst, size_t capacity) const
+        {
+            const size_t count = get_num_elements();
+            if (capacity < count)
+            {
+                throw std::runtime_error(
+                    "Buffer is too small for array: need " +
+                    std::to_string(count) + " elements");
+            }
+
+            if (is_inline())
+            {
+                convert_data(dst, dtype_of<U>(), inline_data->data(), dtype,
+                             count);
+                return count;
+            }
+
+            if (is_chunked())
+            {
+                read_slab_as<U>(std::vector<size_t>(shape.size(), 0), shape,
+                                dst);
+                return count;
+            }
 
-            if (byteorder != system_byte_order)
+            if (not has_default_layout())
             {
-                byteswap_data(ptr, header->get_data_size()/sizeof(T));
+                decode_strided(dst, count);
+                return count;
             }
 
-            return std::shared_ptr<T>(ptr);
+            decode_block(block_ptr, dst, count);
+
+            return count;
         }
 
-    private:
+        /*
+         * Reads the region of the array that starts at the index given by
+         * start and has the shape given by count, converting each element to
+         * type U. The region is stored in dst as a contiguous row-major array.
+         * For chunked arrays, only the chunks that intersect the region are
+         * decompressed; this happens in parallel if a thread pool is given.
+         */
+        template <typename U>
+        void read_slab_as(std::vector<size_t> start, std::vector<size_t> count,
+                          U *dst, ThreadPool *pool = nullptr) const
+        {
+            CHECK_ARRAY_READABLE;
+
+            ChunkGrid grid(shape, is_chunked() ? chunk_shape : shape);
+            auto chunks = grid.find_chunks(start, count);
+
+            auto read_chunk = [&](size_t index)
+            {
+                read_chunk_region(grid, index, start, count, dst);
+            };
+
+            if (pool == nullptr || chunks.size() < 2)
+            {
+                for (auto index : chunks)
+                {
+                    read_chunk(index);
+                }
+
+                return;
+            }
+
+            std::vector<std::future<void>> futures;
+            for (auto index : chunks)
+            {
+                futures.push_back(pool->submit([&read_chunk, index]() {
+                    read_chunk(index);
+                }));
+            }
+
+            /* Every task refers to this frame, so wait for all of them first */
+            for (auto &future : futures)
+            {
+                future.wait();
+            }
+
+            for (auto &future : futures)
+            {
+                future.get();
+            }
+        }
+
+        /* Same as above, but returns the region in a newly allocated buffer */
+        template <typename U>
+        std::shared_ptr<U> read_slab_as(std::vector<size_t> start,
+                                        std::vector<size_t> count,
+                                        ThreadPool *pool = nullptr) const
+        {
+            U *ptr = (U *) malloc(count_elements(count) * sizeof(U));
+            if (ptr == nullptr)
+            {
+                throw std::runtime_error("Unable to allocate memory for array data");
+            }
+
+            std::shared_ptr<U> buffer(ptr, [](U *p) { free(p); });
+            read_slab_as<U>(start, count, ptr, pool);
+
+            return buffer;
+        }
+
+    protected:
         friend class AsdfFile;
-        friend struct YAML::convert<Asdf::NDArray<T>>;
-        friend struct YAML::as_if<Asdf::NDArray<T>, void>;
+        friend struct YAML::convert<Asdf::GenericNDArray>;
 
         int source;
+        DType dtype = unknown_dtype;
         std::string datatype;
         std::string byteorder;
         std::vector<size_t> shape;
-        const uint8_t *block_ptr;
+        const uint8_t *block_ptr = nullptr;
+        std::shared_ptr<FileData> file_data;
         CompressionType compression = CompressionType::none;
+        ShuffleType shuffle = no_shuffle;
         bool read_allowed = false;
+        /* The first dimension of a streamed array is determined on read */
+        bool streamed = false;
 
-        /* Default constructor */
-        NDArray() { };
+        /* Layout of the elements in the block; no strides means contiguous */
+        size_t offset = 0;
+        std::vector<ptrdiff_t> strides;
+        std::string order = "C";
+
+        /* Only used by chunked arrays, where each chunk is its own block */
+        std::vector<size_t> chunk_shape;
+        std::vector<int> chunk_sources;
+        std::vector<const uint8_t *> chunk_blocks;
+
+        /* Elements of an inline array, in native byte order */
+        std::shared_ptr<const std::vector<uint8_t>> inline_data;
 
         /*
-         * This constructor is called when creating a new array node to be
-         * stored in the tree.
+         * This constructor is called when creating a new GenericNDArray object
+         * from a YAML representation (in the "decode" method defined below).
          */
-        NDArray(int source, std::vector<size_t> shape,
-                CompressionType compression = CompressionType::none)
+        GenericNDArray(int source, std::vector<size_t> shape,
+                       std::string datatype, std::string byteorder)
         {
-            if (compression == unknown)
-            {
-                std::string msg("'unknown' is not a valid option for array compression");
-                throw std::runtime_error(msg);
-            }
-
             this->source = source;
-            this->byteorder = get_system_byte_order();
             this->shape = shape;
-            this->datatype = dtype_to_string<T>();
-            this->compression = compression;
+            this->dtype = DType_from_string(datatype);
+            this->datatype = datatype;
+            this->byteorder = byteorder;
         }
 
-        /* Simple constructor for a 1D array */
-        NDArray(int source, T *data, size_t shape,
-                CompressionType compression = CompressionType::none) :
-            NDArray(source, data, std::vector<size_t> { shape }, compression) {}
+        /* Stores the array in the tree rather than in a block of its own */
+        void set_inline_data(std::vector<uint8_t> data)
+        {
+            this->inline_data = std::make_shared<const std::vector<uint8_t>>(
+                    std::move(data));
+            this->source = -1;
+            this->byteorder = get_system_byte_order();
+            this->compression = CompressionType::none;
+            this->shuffle = no_shuffle;
+            this->read_allowed = true;
+        }
 
-        /*
-         * This constructor is called when creating a new NDArray object from a
-         * YAML representation (in the "decode" method defined below). It is
-         * private since it will never be used by application code.
-         */
-        NDArray(int source, std::vector<size_t> shape, std::string datatype)
+        /* Size of a single element in the data block, in bytes */
+        size_t element_size(void) const
         {
-            if (not dtype_matches<T>(datatype))
+            const size_t size = DType_size(dtype);
+            if (size == 0)
             {
                 throw std::runtime_error(
-                    "Incompatible template argument for NDArray with datatype " + datatype);
+                    "Can't access array data: unsupported datatype " + datatype);
             }
 
-            this->source = source;
-            this->shape = shape;
-            this->datatype = datatype;
+            return size;
         }
 
-        void set_array_block(const void *block_ptr)
+        void set_array_block(const void *block_ptr,
+                             std::shared_ptr<FileData> file_data = nullptr)
         {
             this->block_ptr = (const uint8_t *) block_ptr;
+            this->file_data = file_data;
             this->read_allowed = true;
+
+            if (streamed)
+            {
+                const block_header_t *header = (const block_header_t *) block_ptr;
+                if (not header->is_streamed() || file_data == nullptr)
+                {
+                    throw std::runtime_error(
+                        "Array with unknown length is not in a streamed block");
+                }
+
+                /* Only complete rows are considered part of the array */
+                const uint8_t *end = file_data->get_data() + file_data->get_size();
+                const uint8_t *start = this->block_ptr + header->total_header_size();
+                const size_t row_bytes = count_elements(shape, 1) * element_size();
+
+                shape[0] = row_bytes ? (end - start) / row_bytes : 0;
+            }
         }
 
-        friend std::ostream&
-        operator<<(std::ostream &strm, const NDArray<T> &array)
+        void set_chunk_blocks(std::vector<const uint8_t *> chunk_blocks,
+                              std::shared_ptr<FileData> file_data = nullptr)
         {
-            strm << "NDArray[ ";
-            for (auto dim : array.shape)
+            /* The first chunk stands in for the array's compression type */
+            set_array_block(chunk_blocks.empty() ? nullptr : chunk_blocks[0],
+                            file_data);
+            this->chunk_blocks = chunk_blocks;
+        }
+
+        /* Strides of an array whose elements are stored without gaps */
+        static std::vector<ptrdiff_t>
+        contiguous_strides(const std::vector<size_t> &shape, size_t elem_size,
+                           std::string order)
+        {
+            std::vector<ptrdiff_t> result(shape.size());
+            ptrdiff_t stride = elem_size;
+
+            for (size_t i = 0; i < shape.size(); i++)
             {
-                strm << dim << ", ";
+                /* Column-major order varies the first index fastest */
+                size_t dim = (order == "F") ? i : shape.size() - 1 - i;
+                result[dim] = stride;
+                stride *= shape[dim];
             }
 
-            strm << "], datatype=" << array.datatype;
-            strm << ", source=" << array.source;
-            strm << ", compression=" << CompressionType_to_string(array.get_compression_type());
+            return result;
+        }
 
-            return strm;
+        /* Makes sure that every element lies within the data of the block */
+        void check_layout(size_t data_size) const
+        {
+            auto layout = get_strides();
+            if (layout.size() != shape.size())
+            {
+                throw std::runtime_error(
+                    "Array strides must have one entry for each dimension");
+            }
+
+            ptrdiff_t lowest = offset;
+            ptrdiff_t highest = offset;
+
+            for (size_t i = 0; i < shape.size(); i++)
+            {
+                if (shape[i] == 0)
+                {
+                    return;
+                }
+
+                ptrdiff_t extent = (ptrdiff_t) (shape[i] - 1) * layout[i];
+                if (extent < 0)
+                {
+                    lowest += extent;
+                }
+                else
+                {
+                    highest += extent;
+                }
+            }
+
+            if (lowest < 0 or
+                highest + (ptrdiff_t) element_size() > (ptrdiff_t) data_size)
+            {
+                throw std::runtime_error(
+                    "Array layout exceeds the bounds of its block");
+            }
         }
-};
 
-} /* namespace Asdf */
+        /* Size of the array data in its block, in bytes */
+        size_t get_data_bytes(void) const
+        {
+            const block_header_t *header = (const block_header_t *) block_ptr;
+            if (header->is_streamed())
+            {
+                return count_elements(shape) * element_size();
+            }
 
-namespace YAML {
+            return header->get_data_size();
+        }
 
-template <typename T>
-struct convert<Asdf::NDArray<T>>
-{
-    /*
-     * This method defines the way in which NDArray metadata is written to the
-     * YAML tree. The block allocation of the NDArray is handled at a higher
-     * level when the NDArray object is assigned to a Node belonging to an
-     * AsdfFile tree.
-     */
-    static Node encode(const Asdf::NDArray<T> &array)
-    {
-        Asdf::Node node;
-        node.SetTag(NDARRAY_TAG);
+        /* Blocks that were stored uncompressed are never shuffled */
+        ShuffleType block_shuffle(const uint8_t *block) const
+        {
+            const block_header_t *header = (const block_header_t *) block;
+            if (header->get_compression() == CompressionType::none)
+            {
+                return no_shuffle;
+            }
 
-        /* TODO: handle the case of inline arrays */
-        node["source"] = array.get_source();
-        node["datatype"] = array.datatype;
-        node["byteorder"] = array.byteorder;
+            return shuffle;
+        }
 
-        for (auto x : array.get_shape())
+        /*
+         * Indicates whether elements of type U can be copied from the block
+         * as they are. Booleans are always converted, so that they are
+         * guaranteed to hold 0 or 1.
+         */
+        template <typename U> bool is_stored_as(void) const
         {
-            node["shape"].push_back(x);
+            return dtype_of<U>() == dtype && dtype != bool8_dtype;
         }
 
-        return node;
-    }
+        /*
+         * Decodes count elements from the given block into dst, undoing any
+         * shuffle filter, converting to the native byte order and then to
+         * type U.
+         */
+        template <typename U>
+        void decode_block(const uint8_t *block, U *dst, size_t count) const
+        {
+            const block_header_t *header = (const block_header_t *) block;
+            const DType target = dtype_of<U>();
+            const DType source_type = dtype;
+            const size_t elem_size = element_size();
+            const size_t size = count * elem_size;
+            const bool swap = elem_size > 1 &&
+                              byteorder != get_system_byte_order();
 
-    /*
-     * This method defines the way in which NDArray objects are constructed
-     * when reading from a YAML tree. The AsdfFile pointer belonging to the
-     * parent node is passed to the new NDArray object in order to facilitate
-     * access to the associated data block.
-     */
-    static bool decode(const Node &node, Asdf::NDArray<T> &array)
-    {
-        if (node.Tag() != NDARRAY_TAG)
+            if (header->is_streamed())
+            {
+                /* Streamed blocks are never compressed */
+                convert_data(dst, target, block + header->total_header_size(),
+                             source_type, count, swap);
+                return;
+            }
+
+            if (block_shuffle(block) != no_shuffle)
+            {
+                std::vector<uint8_t> shuffled(size);
+                read_block_data(block, shuffled.data(), size);
+
+                if (is_stored_as<U>())
+                {
+                    unshuffle_data((uint8_t *) dst, shuffled.data(), count,
+                                   elem_size, shuffle);
+
+                    if (swap)
+                    {
+                        byteswap_buffer(dst, count, elem_size);
+                    }
+
+                    return;
+                }
+
+                std::vector<uint8_t> plain(size);
+                unshuffle_data(plain.data(), shuffled.data(), count,
+                               elem_size, shuffle);
+                convert_data(dst, target, plain.data(), source_type, count,
+                             swap);
+
+                return;
+            }
+
+            if (is_stored_as<U>() and not swap)
+            {
+                read_block_data(block, dst, size);
+                return;
+            }
+
+            if (header->get_data_size() > size)
+            {
+                throw std::runtime_error("Buffer is too small to hold block data");
+            }
+
+            uint8_t *output = (uint8_t *) dst;
+            read_block_windows(block, elem_size,
+                [=](const uint8_t *window, size_t offset, size_t length)
+                {
+                    convert_data(output + offset / elem_size * sizeof(U),
+                                 target, window, source_type,
+                                 length / elem_size, swap);
+                });
+        }
+
+        /*
+         * Decodes an array that does not simply fill its block, because it
+         * starts at an offset or its elements are strided. Compressed blocks
+         * are decoded in full, and the elements are then gathered into dst.
+         * Uncompressed blocks are gathered directly from the file.
+         */
+        template <typename U>
+        void decode_strided(U *dst, size_t count) const
         {
-            return false;
+            const block_header_t *header = (const block_header_t *) block_ptr;
+            const size_t elem_size = element_size();
+            const size_t data_size = header->get_data_size();
+            const bool swap = elem_size > 1 &&
+                              byteorder != get_system_byte_order();
+
+            const uint8_t *data = block_ptr + header->total_header_size();
+            std::vector<uint8_t> decoded;
+
+            if (header->get_compression() != CompressionType::none)
+            {
+                decoded.resize(data_size);
+                read_block_data(block_ptr, decoded.data(), data_size);
+
+                if (block_shuffle(block_ptr) != no_shuffle)
+                {
+                    std::vector<uint8_t> plain(data_size);
+                    unshuffle_data(plain.data(), decoded.data(),
+                                   data_size / elem_size, elem_size, shuffle);
+                    decoded.swap(plain);
+                }
+
+                data = decoded.data();
+            }
+
+            check_layout(data_size);
+
+            if (is_stored_as<U>())
+            {
+                copy_strided((uint8_t *) dst, data + offset, shape,
+                             get_strides(), elem_size);
+
+                if (swap)
+                {
+                    byteswap_buffer(dst, count, elem_size);
+                }
+
+                return;
+            }
+
+            std::vector<uint8_t> gathered(count * elem_size);
+            copy_strided(gathered.data(), data + offset, shape, get_strides(),
+                         elem_size);
+            convert_data(dst, dtype_of<U>(), gathered.data(), dtype, count,
+                         swap);
         }
 
-        auto source = node["source"].as<int>();
-        auto shape = node["shape"].as<std::vector<size_t>>();
-        auto datatype = node["datatype"].as<std::string>();
+        static size_t count_elements(const std::vector<size_t> &shape,
+                                     size_t first = 0)
+        {
+            size_t count = 1;
+            for (size_t i = first; i < shape.size(); i++)
+            {
+                count *= shape[i];
+            }
+
+            return count;
+        }
+
+        /* Decodes one chunk and copies its overlap with the region into dst */
+        template <typename U>
+        void read_chunk_region(const ChunkGrid &grid, size_t index,
+                               const std::vector<size_t> &start,
+                               const std::vector<size_t> &count,
+                               U *dst) const
+        {
+            const uint8_t *block = is_chunked() ? chunk_blocks[index] : block_ptr;
+            const block_header_t *header = (const block_header_t *) block;
+
+            auto origin = grid.chunk_origin(index);
+            auto extent = grid.chunk_extent(index);
+
+            /* Inline arrays and those with a layout of their own are read whole */
+            const bool whole = is_inline() or
+                               (not is_chunked() and not has_default_layout());
+
+            if (not whole and
+                header->get_data_size() != count_elements(extent) * element_size())
+            {
+                throw std::runtime_error("Array block has an unexpected size");
+            }
+
+            const size_t ndim = shape.size();
+            std::vector<size_t> src_start(ndim), dst_start(ndim), overlap(ndim);
+            for (size_t i = 0; i < ndim; i++)
+            {
+                size_t lower = std::max(start[i], origin[i]);
+                size_t upper = std::min(start[i] + count[i], origin[i] + extent[i]);
+
+                src_start[i] = lower - origin[i];
+                dst_start[i] = lower - start[i];
+                overlap[i] = upper - lower;
+            }
+
+            const uint8_t *src = nullptr;
+            std::vector<uint8_t> decoded;
+
+            if (whole)
+            {
+                decoded.resize(count_elements(extent) * sizeof(U));
+                read_into_as((U *) decoded.data(), count_elements(extent));
+
+                src = decoded.data();
+            }
+            else if (header->get_compression() != CompressionType::none ||
+                     byteorder != get_system_byte_order() || not is_stored_as<U>())
+            {
+                decoded.resize(count_elements(extent) * sizeof(U));
+                decode_block(block, (U *) decoded.data(), count_elements(extent));
+
+                src = decoded.data();
+            }
+            else
+            {
+                /* Uncompressed native data can be copied straight from the file */
+                src = block + header->total_header_size();
+            }
+
+            copy_hyperslab((uint8_t *) dst, count, dst_start,
+                           src, extent, src_start, overlap, sizeof(U));
+        }
+
+        friend std::ostream&
+        operator<<(std::ostream &strm, const GenericNDArray &array)
+        {
+            strm << "NDArray[ ";
+            for (auto dim : array.shape)
+            {
+                strm << dim << ", ";
+            }
+
+            strm << "], datatype=" << array.datatype;
+            strm << ", source=" << array.source;
+            strm << ", compression=" << CompressionType_to_string(array.get_compression_type());
+
+            return strm;
+        }
+};
+
+template <typename T>
+class NDArray : public GenericNDArray
+{
+    public:
+        /*
+         * Points to the first element of the array in its block. The data is
+         * only a plain array if the array has the default layout.
+         */
+        T * get_raw_data(void)
+        {
+            CHECK_ARRAY_READABLE;
+
+            if (is_chunked())
+            {
+                throw std::runtime_error(
+                    "Can't access raw data of a chunked array: use read_slab");
+            }
+
+            if (is_inline())
+            {
+                return (T *) inline_data->data();
+            }
+
+            const block_header_t *header = (const block_header_t *) block_ptr;
+            return  (T *)(block_ptr + header->total_header_size() + offset);
+        }
+
+        std::shared_ptr<T> read(void) const
+        {
+            return read_as<T>();
+        }
+
+        /*
+         * Decompresses and byteswaps the array data directly into a buffer
+         * provided by the caller, which can hold up to capacity elements. No
+         * intermediate buffers are allocated, unless the data was shuffled
+         * before compression. Data that needs to be byteswapped is swapped a
+         * window at a time as it is decompressed, so it only passes through
+         * main memory once. Returns the number of elements that were read.
+         */
+        size_t read_into(T *dst, size_t capacity) const
+        {
+            return read_into_as<T>(dst, capacity);
+        }
+
+        /*
+         * Reads the region of the array that starts at the index given by
+         * start and has the shape given by count. See read_slab_as.
+         */
+        void read_slab(std::vector<size_t> start, std::vector<size_t> count,
+                       T *dst, ThreadPool *pool = nullptr) const
+        {
+            read_slab_as<T>(start, count, dst, pool);
+        }
+
+        /* Same as above, but returns the region in a newly allocated buffer */
+        std::shared_ptr<T> read_slab(std::vector<size_t> start,
+                                     std::vector<size_t> count,
+                                     ThreadPool *pool = nullptr) const
+        {
+            return read_slab_as<T>(start, count, pool);
+        }
+
+        /*
+         * Same as read, but the memory for the array data is obtained from
+         * the given allocator. The buffer is returned to the allocator when
+         * the last reference to it goes away.
+         */
+        template <typename Allocator>
+        std::shared_ptr<T> read(Allocator allocator) const
+        {
+            typedef typename std::allocator_traits<Allocator>::template
+                rebind_alloc<T> alloc_type;
+            typedef std::allocator_traits<alloc_type> traits;
+
+            alloc_type alloc(allocator);
+            const size_t count = get_num_elements();
+
+            T *ptr = traits::allocate(alloc, count);
+
+            try
+            {
+                read_into(ptr, count);
+            }
+            catch (...)
+            {
+                traits::deallocate(alloc, ptr, count);
+                throw;
+            }
+
+            return std::shared_ptr<T>(ptr,
+                    [alloc, count](T *p) mutable {
+                        traits::deallocate(alloc, p, count);
+                    });
+        }
+
+        /*
+         * Returns a view of the array data. For uncompressed blocks in native
+         * byte order this points directly into the file's memory map and no
+         * data is copied, even if the array is a strided view of its block.
+         * If the data needs to be byteswapped, the block is mapped again
+         * privately (copy-on-write) and swapped in place. A copy is only made
+         * for compressed blocks, when the file was not memory mapped, or when
+         * the strides are not a multiple of the element size. Swapping a large
+         * block is split across the given pool, if any.
+         */
+        ArrayView<const T> view(ThreadPool *pool = nullptr) const
+        {
+            CHECK_ARRAY_READABLE;
+
+            std::vector<ptrdiff_t> layout;
+            if (is_chunked() or is_inline() or is_compressed() or
+                not element_strides(layout))
+            {
+                return ArrayView<const T>(read(), shape, true);
+            }
+
+            const block_header_t *header = (const block_header_t *) block_ptr;
+            const uint8_t *raw = block_ptr + header->total_header_size();
+
+            if (byteorder == get_system_byte_order())
+            {
+                return ArrayView<const T>(
+                        std::shared_ptr<const T>(file_data,
+                                                 (const T *)(raw + offset)),
+                        shape, layout);
+            }
+
+            std::shared_ptr<uint8_t> mapping;
+            if (file_data != nullptr)
+            {
+                mapping = file_data->map_private(
+                        raw - file_data->get_data(), get_data_bytes());
+            }
+
+            if (mapping == nullptr)
+            {
+                return ArrayView<const T>(read(), shape, true);
+            }
+
+            /* The whole block is swapped, since other arrays may share it */
+            T *swapped = (T *) mapping.get();
+            byteswap_data(swapped, get_data_bytes() / sizeof(T), pool);
+
+            return ArrayView<const T>(
+                    std::shared_ptr<const T>(
+                        mapping, (const T *)(mapping.get() + offset)),
+                    shape, layout, true);
+        }
+
+        /*
+         * Returns a mutable view that points directly into the memory map of
+         * a file opened in read_write mode, so individual elements can be
+         * changed without rewriting the file. Only uncompressed arrays in
+         * native byte order can be modified this way. Changes are written to
+         * the file and the block checksum is updated when the view is
+         * flushed.
+         */
+        ArrayView<T> writable_view(void)
+        {
+            CHECK_ARRAY_READABLE;
+
+            if (file_data == nullptr or not file_data->is_writable())
+            {
+                throw std::runtime_error(
+                    "Can't modify array: file was not opened for writing");
+            }
+
+            std::vector<ptrdiff_t> layout;
+            if (is_chunked() or is_inline() or is_compressed() or
+                byteorder != get_system_byte_order() or
+                not element_strides(layout))
+            {
+                throw std::runtime_error(
+                    "Only uncompressed arrays in native byte order "
+                    "can be modified in place");
+            }
+
+            /* The block lives in the file's writable mapping */
+            std::shared_ptr<FileData> file_data = this->file_data;
+            const size_t offset = block_ptr - file_data->get_data();
+            uint8_t *block = file_data->get_data() + offset;
+
+            const block_header_t *header = (const block_header_t *) block;
+            const size_t length = header->total_header_size() + get_data_bytes();
+            const bool streamed_block = header->is_streamed();
+
+            T *raw = (T *)(block + header->total_header_size() + this->offset);
+            ArrayView<T> view(std::shared_ptr<T>(file_data, raw), shape, layout);
+
+            view.flusher = [file_data, block, offset, length, streamed_block]()
+            {
+                /* Streamed blocks have no used size, hence no checksum */
+                if (not streamed_block)
+                {
+                    update_block_checksum(block);
+                }
+
+                file_data->sync(offset, length);
+            };
+
+            return view;
+        }
+
+    private:
+        friend class AsdfFile;
+        friend struct YAML::convert<Asdf::NDArray<T>>;
+        friend struct YAML::as_if<Asdf::NDArray<T>, void>;
+
+        /* Default constructor */
+        NDArray() { };
+
+        /*
+         * This constructor is called when creating a new array node to be
+         * stored in the tree.
+         */
+        NDArray(int source, std::vector<size_t> shape,
+                CompressionOptions compression = CompressionType::none)
+        {
+            if (compression.type == unknown)
+            {
+                std::string msg("'unknown' is not a valid option for array compression");
+                throw std::runtime_error(msg);
+            }
+
+            this->source = source;
+            this->byteorder = get_system_byte_order();
+            this->shape = shape;
+            this->dtype = dtype_of<T>();
+            this->datatype = dtype_to_string<T>();
+            this->compression = compression.type;
+
+            /* The filter is only applied to data that is compressed */
+            if (compression.type != CompressionType::none)
+            {
+                this->shuffle = compression.shuffle;
+            }
+        }
+
+        /* Constructor for a new chunked array */
+        NDArray(std::vector<int> chunk_sources, std::vector<size_t> shape,
+                std::vector<size_t> chunk_shape,
+                CompressionOptions compression = CompressionType::none) :
+            NDArray(chunk_sources.empty() ? -1 : chunk_sources[0], shape,
+                    compression)
+        {
+            this->chunk_shape = chunk_shape;
+            this->chunk_sources = chunk_sources;
+        }
+
+        /* Constructor for a new streamed array, with rows of the given shape */
+        explicit NDArray(std::vector<size_t> row_shape) :
+            NDArray(-1, row_shape)
+        {
+            this->shape.insert(this->shape.begin(), 0);
+            this->streamed = true;
+        }
+
+        /* Constructor for a view that shares the block of another array */
+        NDArray(const NDArray<T> &base, std::vector<size_t> shape,
+                std::vector<ptrdiff_t> strides, size_t offset) :
+            NDArray<T>(base)
+        {
+            this->shape = shape;
+            this->strides = strides;
+            this->offset = offset;
+        }
+
+        /*
+         * Converts the strides to elements of T, if the layout can be
+         * addressed as an array of T. The bounds of the layout are checked
+         * along the way.
+         */
+        bool element_strides(std::vector<ptrdiff_t> &result) const
+        {
+            if (has_default_layout())
+            {
+                result = contiguous_strides(shape, 1, "C");
+                return true;
+            }
+
+            check_layout(get_data_bytes());
+
+            if (offset % sizeof(T) != 0)
+            {
+                return false;
+            }
+
+            result.clear();
+            for (auto stride : get_strides())
+            {
+                if (stride % (ptrdiff_t) sizeof(T) != 0)
+                {
+                    return false;
+                }
+
+                result.push_back(stride / (ptrdiff_t) sizeof(T));
+            }
+
+            return true;
+        }
+
+        /* Simple constructor for a 1D array */
+        NDArray(int source, T *data, size_t shape,
+                CompressionType compression = CompressionType::none) :
+            NDArray(source, data, std::vector<size_t> { shape }, compression) {}
+
+        /*
+         * This constructor is called when creating a new NDArray object from a
+         * YAML representation (in the "decode" method defined below). It is
+         * private since it will never be used by application code.
+         */
+        explicit NDArray(const GenericNDArray &array) : GenericNDArray(array)
+        {
+            if (dtype != dtype_of<T>())
+            {
+                throw std::runtime_error(
+                    "Incompatible template argument for NDArray with datatype " + datatype);
+            }
+        }
+};
+
+} /* namespace Asdf */
+
+namespace YAML {
+
+template <>
+struct convert<Asdf::GenericNDArray>
+{
+    /*
+     * This method defines the way in which NDArray metadata is written to the
+     * YAML tree. The block allocation of the NDArray is handled at a higher
+     * level when the NDArray object is assigned to a Node belonging to an
+     * AsdfFile tree.
+     */
+    static Node encode(const Asdf::GenericNDArray &array)
+    {
+        Asdf::Node node;
+
+        if (array.is_chunked())
+        {
+            node.SetTag(CHUNKED_NDARRAY_TAG);
+        }
+        else if (array.is_inline())
+        {
+            node.SetTag(NDARRAY_TAG);
+            node["data"] = Asdf::encode_inline_data(
+                    array.inline_data->data(), array.dtype, array.shape);
+        }
+        else
+        {
+            node.SetTag(array.shuffle != no_shuffle ?
+                        SHUFFLED_NDARRAY_TAG : NDARRAY_TAG);
+            node["source"] = array.get_source();
+        }
+
+        node["datatype"] = array.datatype;
+
+        /* Inline data is text, so it has no byte order */
+        if (not array.is_inline())
+        {
+            node["byteorder"] = array.byteorder;
+        }
+
+        if (array.shuffle != no_shuffle)
+        {
+            node["shuffle"] = ShuffleType_to_string(array.shuffle);
+        }
+
+        for (size_t i = 0; i < array.shape.size(); i++)
+        {
+            if (i == 0 && array.streamed)
+            {
+                node["shape"].push_back("*");
+            }
+            else
+            {
+                node["shape"].push_back(array.shape[i]);
+            }
+        }
+
+        /* Views of a block record where their elements are */
+        if (array.offset != 0)
+        {
+            node["offset"] = array.offset;
+        }
+
+        if (not array.strides.empty() or array.order != "C")
+        {
+            const size_t elem_size = array.element_size();
+            auto layout = array.get_strides();
+            auto row_major = array.contiguous_strides(array.shape, elem_size, "C");
+            auto column_major = array.contiguous_strides(array.shape, elem_size, "F");
+
+            if (layout == column_major and layout != row_major)
+            {
+                node["order"] = "F";
+            }
+            else if (layout != row_major)
+            {
+                for (auto x : layout)
+                {
+                    node["strides"].push_back(x);
+                }
+
+                node["strides"].SetStyle(YAML::EmitterStyle::Flow);
+            }
+        }
+
+        if (array.is_chunked())
+        {
+            for (auto x : array.chunk_shape)
+            {
+                node["chunk_shape"].push_back(x);
+            }
+
+            for (auto x : array.chunk_sources)
+            {
+                node["chunks"].push_back(x);
+            }
+
+            node["chunks"].SetStyle(YAML::EmitterStyle::Flow);
+        }
+
+        return node;
+    }
+
+    /*
+     * This method defines the way in which NDArray objects are constructed
+     * when reading from a YAML tree. The AsdfFile pointer belonging to the
+     * parent node is passed to the new NDArray object in order to facilitate
+     * access to the associated data block.
+     */
+    static bool decode(const Node &node, Asdf::GenericNDArray &array)
+    {
+        if (node.Tag() == CHUNKED_NDARRAY_TAG)
+        {
+            auto shape = node["shape"].as<std::vector<size_t>>();
+            auto datatype = node["datatype"].as<std::string>();
+            auto byteorder = node["byteorder"].as<std::string>(get_system_byte_order());
+            auto chunks = node["chunks"].as<std::vector<int>>();
+
+            array = Asdf::GenericNDArray(chunks.empty() ? -1 : chunks[0],
+                                         shape, datatype, byteorder);
+            array.chunk_shape = node["chunk_shape"].as<std::vector<size_t>>();
+            array.chunk_sources = chunks;
+            array.shuffle = ShuffleType_from_string(
+                    node["shuffle"].as<std::string>("none"));
+
+            return true;
+        }
+
+        if (node.Tag() != NDARRAY_TAG and node.Tag() != SHUFFLED_NDARRAY_TAG)
+        {
+            return false;
+        }
+
+        /* Small arrays can be stored in the tree instead of a block */
+        if (node["data"])
+        {
+            auto data = node["data"];
+            auto datatype = node["datatype"] ?
+                node["datatype"].as<std::string>() :
+                DType_to_string(Asdf::infer_inline_dtype(data));
+            auto shape = node["shape"] ?
+                node["shape"].as<std::vector<size_t>>() :
+                Asdf::inline_data_shape(data);
+
+            array = Asdf::GenericNDArray(-1, shape, datatype,
+                                         get_system_byte_order());
+            array.set_inline_data(
+                    Asdf::decode_inline_data(data, array.dtype, shape));
+
+            return true;
+        }
+
+        auto source = node["source"].as<int>();
+        auto datatype = node["datatype"].as<std::string>();
+        auto byteorder = node["byteorder"].as<std::string>(get_system_byte_order());
+
+        /* A streamed array has '*' as its first dimension */
+        bool streamed = false;
+        std::vector<size_t> shape;
+        for (auto dim : node["shape"])
+        {
+            if (shape.empty() && dim.Scalar() == "*")
+            {
+                streamed = true;
+                shape.push_back(0);
+            }
+            else
+            {
+                shape.push_back(dim.as<size_t>());
+            }
+        }
+
+        array = Asdf::GenericNDArray(source, shape, datatype, byteorder);
+        array.streamed = streamed;
+        array.offset = node["offset"].as<size_t>(0);
+        array.order = node["order"].as<std::string>("C");
+
+        if (array.order != "C" and array.order != "F")
+        {
+            throw std::runtime_error("Unsupported array order: " + array.order);
+        }
+
+        if (node["strides"])
+        {
+            array.strides = node["strides"].as<std::vector<ptrdiff_t>>();
+            if (array.strides.size() != shape.size())
+            {
+                throw std::runtime_error(
+                    "Array strides must have one entry for each dimension");
+            }
+        }
+
+        array.shuffle = ShuffleType_from_string(
+                node["shuffle"].as<std::string>("none"));
+
+        return true;
+    }
+};
+
+template <typename T>
+struct convert<Asdf::NDArray<T>>
+{
+    static Node encode(const Asdf::NDArray<T> &array)
+    {
+        return convert<Asdf::GenericNDArray>::encode(array);
+    }
+
+    /* Arrays with a different datatype than T are rejected */
+    static bool decode(const Node &node, Asdf::NDArray<T> &array)
+    {
+        Asdf::GenericNDArray generic;
+        if (not convert<Asdf::GenericNDArray>::decode(node, generic))
+        {
+            return false;
+        }
 
-        array = Asdf::NDArray<T>(source, shape, datatype);
+        array = Asdf::NDArray<T>(generic);
 
         return true;
     }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <queue>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+
+
+namespace Asdf {
+
+/*
+ * A simple fixed-size pool of worker threads. Tasks are run in the order in
+ * which they are submitted, and their results are delivered through futures.
+ */
+class ThreadPool
+{
+    public:
+        /* A value of 0 uses one thread per available core */
+        ThreadPool(size_t num_threads = 0);
+        ~ThreadPool(void);
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool& operator=(const ThreadPool &) = delete;
+
+        size_t get_num_threads(void) const
+        {
+            return workers.size();
+        }
+
+        /*
+         * Whether the calling thread is a worker of any pool. Tasks that run
+         * on a worker should not wait for further tasks of their own, since
+         * these may be queued behind other tasks that are waiting as well.
+         */
+        static bool in_worker(void);
+
+        template <typename F>
+        std::future<typename std::result_of<F()>::type> submit(F task)
+        {
+            typedef typename std::result_of<F()>::type result_type;
+
+            auto packaged =
+                std::make_shared<std::packaged_task<result_type()>>(task);
+            auto future = packaged->get_future();
+
+            enqueue([packaged]() { (*packaged)(); });
+
+            return future;
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex lock;
+        std::condition_variable condition;
+        bool stopping = false;
+
+        void enqueue(std::function<void()> task);
+        void run(void);
+};
+
+} /* namespace Asdf */
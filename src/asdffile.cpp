@@ -1,24 +1,22 @@
 #include <iostream>
-#include <string>
 #include <fstream>
+#include <streambuf>
+#include <string>
 #include <sstream>
+#include <algorithm>
 
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
+#include <cerrno>
 #ifdef __APPLE__
 #include <mach/error.h>
 #else
 #include <error.h>
 #endif
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
 
-#include <sys/mman.h>
-
 #include <yaml-cpp/yaml.h>
 
 #include <asdf-cpp/asdf.hpp>
@@ -32,40 +30,96 @@
 #define YAML_END_MARKER         "..."
 
 
-static bool parse_header(std::istream &stream)
+/*
+ * Checks the two header lines at the start of the file and returns the offset
+ * of the first line following them, or 0 if the header is invalid.
+ */
+static size_t parse_header(const uint8_t *data, size_t size)
 {
-    std::string line;
-    std::getline(stream, line);
+    const char *begin = (const char *) data;
+    const char *end = begin + size;
+    const char *line = begin;
 
-    if (line.compare(0, strlen(ASDF_HEADER), ASDF_HEADER))
+    const char *headers[] = { ASDF_HEADER, ASDF_STANDARD_HEADER };
+    for (auto header : headers)
     {
-        return false;
-    }
+        const size_t length = strlen(header);
+        if ((size_t) (end - line) < length || memcmp(line, header, length) != 0)
+        {
+            return 0;
+        }
 
-    std::getline(stream, line);
-    if (line.compare(0, strlen(ASDF_STANDARD_HEADER), ASDF_STANDARD_HEADER))
-    {
-        return false;
+        line = (const char *) memchr(line, '\n', end - line);
+        if (line == nullptr)
+        {
+            return 0;
+        }
+
+        line++;
     }
 
-    return true;
+    return line - begin;
 }
 
-static std::streampos
-find_yaml_end(std::stringstream &yaml, std::istream &stream)
+/*
+ * Returns the offset just past the line containing the YAML end marker. The
+ * search uses memmem, which is vectorized in any reasonable libc, so this is
+ * much cheaper than reading the tree line by line. If there is no end marker
+ * the tree is assumed to extend to the end of the data.
+ */
+static size_t find_yaml_end(const uint8_t *data, size_t start, size_t size)
 {
-    std::string line;
+    const char marker[] = "\n" YAML_END_MARKER;
+    const size_t marker_len = sizeof(marker) - 1;
 
-    while(std::getline(stream, line))
+    const char *begin = (const char *) data;
+    const char *current = begin + start - 1;
+    const char *end = begin + size;
+
+    while (current < end)
     {
-        yaml << line << std::endl;
-        if (line.compare(YAML_END_MARKER) == 0)
+        const char *found = (const char *) memmem(current, end - current,
+                                                  marker, marker_len);
+        if (found == nullptr)
         {
             break;
         }
+
+        const char *next = found + marker_len;
+        if (next == end)
+        {
+            return size;
+        }
+        else if (*next == '\n')
+        {
+            return next + 1 - begin;
+        }
+        else if (*next == '\r' && next + 1 < end && next[1] == '\n')
+        {
+            return next + 2 - begin;
+        }
+
+        current = next;
     }
 
-    return stream.tellg();
+    return size;
+}
+
+/*
+ * A read-only streambuf over a region of memory that it does not own. This
+ * allows yaml-cpp to parse the tree directly out of the file data without
+ * making a copy of it first.
+ */
+namespace {
+class MemoryStreamBuf : public std::streambuf
+{
+    public:
+        MemoryStreamBuf(const uint8_t *data, size_t size)
+        {
+            char *begin = (char *) data;
+            setg(begin, begin, begin + size);
+        }
+};
 }
 
 namespace Asdf {
@@ -75,107 +129,151 @@ AsdfFile::AsdfFile()
     asdf_tree = Node();
 }
 
-AsdfFile::AsdfFile(std::string filename)
+AsdfFile::AsdfFile(std::string filename, AccessMode mode)
 {
-    std::ifstream ifs(filename);
-    if (ifs.fail())
-    {
-        std::string msg("Error opening " + filename + ": ");
-        throw std::runtime_error(msg + strerror(errno));
-    }
+    this->filename = filename;
+    this->mode = mode;
 
-    if (!parse_header(ifs))
-    {
-        throw std::runtime_error("Invalid ASDF header");
-    }
+    open_file();
+}
+
+AsdfFile::AsdfFile(std::stringstream &stream)
+{
+    setup_file_data(std::make_shared<FileData>(stream));
+    parse_file_data();
+}
 
-    std::stringstream yaml_data;
-    end_index = find_yaml_end(yaml_data, ifs);
+AsdfFile::~AsdfFile()
+{
+}
 
-    /* Reset stream to the beginning of the file */
-    /* TODO: this should probably be a close */
-    ifs.seekg(0);
+void AsdfFile::open_file()
+{
+    setup_file_data(std::make_shared<FileData>(filename, mode));
+    parse_file_data();
 
-    setup_memmap(filename);
-    find_blocks();
+    /* Arrays created from now on are appended after the existing blocks */
+    if (mode == read_write)
+    {
+        std::vector<size_t> offsets;
+        for (auto block : blocks)
+        {
+            offsets.push_back(block - data);
+        }
 
-    asdf_tree = YAML::Load(yaml_data);
+        block_manager.set_existing_blocks(offsets);
+    }
 }
 
-AsdfFile::AsdfFile(std::stringstream &stream)
+void AsdfFile::parse_file_data()
 {
-    if (!parse_header(stream))
+    const size_t yaml_start = parse_header(data, data_size);
+    if (yaml_start == 0)
     {
         throw std::runtime_error("Invalid ASDF header");
     }
 
-    std::stringstream yaml_data;
-    end_index = find_yaml_end(yaml_data, stream);
-
-    /* Reset stream to the beginning of the file */
-    /* TODO: this should probably be a close */
-    stream.seekg(0);
+    end_index = find_yaml_end(data, yaml_start, data_size);
 
-    copy_stream(stream);
     find_blocks();
 
-    asdf_tree = YAML::Load(yaml_data);
+    MemoryStreamBuf tree_buf(data + yaml_start, end_index - yaml_start);
+    std::istream tree_stream(&tree_buf);
+
+    asdf_tree = YAML::Load(tree_stream);
 }
 
-AsdfFile::~AsdfFile()
+void AsdfFile::setup_file_data(std::shared_ptr<FileData> file_data)
 {
-    if (memmapped)
-    {
-        munmap(data, data_size);
-        close(fd);
-    }
-    else
+    this->file_data = file_data;
+    data = file_data->get_data();
+    data_size = file_data->get_size();
+}
+
+void AsdfFile::find_blocks()
+{
+    if (not find_indexed_blocks())
     {
-        /* TODO: try using shared pointer instead */
-        free(data);
+        walk_blocks();
     }
 }
 
-void AsdfFile::setup_memmap(std::string filename)
+bool AsdfFile::valid_block(const uint8_t *block, const uint8_t *limit) const
 {
-    struct stat sb;
-
-    fd = open(filename.c_str(), O_RDONLY);
+    const block_header_t *bh = (const block_header_t *) block;
 
-    fstat(fd, &sb);
-    data_size = sb.st_size;
+    if (block < data || block + sizeof(block_header_t) > limit)
+    {
+        return false;
+    }
 
-    data = (uint8_t *) mmap(NULL, data_size, PROT_READ, MAP_SHARED, fd, 0);
-    if (data == MAP_FAILED)
+    if (memcmp(bh->magic, asdf_block_magic, sizeof(bh->magic)) != 0)
     {
-        close(fd);
-        std::string msg("Error memory mapping file: ");
-        throw std::runtime_error(msg + strerror(errno));
+        return false;
     }
 
-    memmapped = true;
+    return bh->total_header_size() + bh->get_allocated_size() <=
+        (size_t) (limit - block);
 }
 
-void AsdfFile::copy_stream(std::iostream &stream)
+/*
+ * Uses the block index at the end of the file to locate the blocks without
+ * touching each of them. Only the first and last blocks are checked here;
+ * the rest are checked when they are accessed by get_block.
+ */
+bool AsdfFile::find_indexed_blocks()
 {
-    stream.seekp(0, std::ios::end);
-    data_size = stream.tellp();
+    std::vector<size_t> offsets;
+    const uint8_t *index = read_block_index(offsets, data + end_index,
+                                            data + data_size);
 
-    std::basic_streambuf<char> *sbuf = stream.rdbuf();
-    data = (uint8_t *) malloc(data_size);
-    if (data == nullptr)
+    if (index == nullptr || offsets.empty())
     {
-        std::string msg("Error creating buffer for file data: ");
-        throw std::runtime_error(msg + strerror(errno));
+        return false;
+    }
+
+    size_t next = end_index;
+    for (auto offset : offsets)
+    {
+        if (offset < next || offset + sizeof(block_header_t) > (size_t) (index - data))
+        {
+            return false;
+        }
+
+        next = offset + sizeof(block_header_t);
+    }
+
+    if (not valid_block(data + offsets.front(), index) ||
+        not valid_block(data + offsets.back(), index))
+    {
+        return false;
+    }
+
+    blocks.clear();
+    for (auto offset : offsets)
+    {
+        blocks.push_back(data + offset);
     }
 
-    sbuf->sgetn((char *) data, data_size);
+    blocks_from_index = true;
+    return true;
 }
 
-void AsdfFile::find_blocks()
+void AsdfFile::walk_blocks() const
 {
     uint8_t *current = data + end_index;
 
+    blocks.clear();
+    blocks_from_index = false;
+
+    /* Skip any padding that was reserved after the tree */
+    current = (uint8_t *) memmem(current, data + data_size - current,
+                                 asdf_block_magic, sizeof(asdf_block_magic));
+    if (current == nullptr)
+    {
+        return;
+    }
+
     while ((current + sizeof(block_header_t)) < (data + data_size))
     {
         block_header_t *bh = (block_header_t *)(current);
@@ -191,10 +289,109 @@ void AsdfFile::find_blocks()
         }
 
         blocks.push_back(current);
+
+        /* The data of a streamed block extends to the end of the file */
+        if (bh->is_streamed())
+        {
+            break;
+        }
+
         current += bh->get_allocated_size() + bh->total_header_size();
     }
 }
 
+const uint8_t *AsdfFile::get_block(int source) const
+{
+    /* Negative sources count back from the last block */
+    auto resolve = [this](int source) -> long {
+        return source < 0 ? source + (long) blocks.size() : source;
+    };
+
+    long index = resolve(source);
+
+    if (blocks_from_index)
+    {
+        bool in_range = index >= 0 && (size_t) index < blocks.size();
+        if (not in_range || not valid_block(blocks[index], data + data_size))
+        {
+            /* The index is stale, so fall back to finding the blocks directly */
+            walk_blocks();
+            index = resolve(source);
+        }
+    }
+
+    if (index < 0 || (size_t) index >= blocks.size())
+    {
+        throw std::runtime_error(
+            "Invalid block source: " + std::to_string(source));
+    }
+
+    return blocks[index];
+}
+
+void AsdfFile::attach_blocks(GenericNDArray &array) const
+{
+    if (array.is_inline())
+    {
+        /* The data was already read from the tree */
+        return;
+    }
+    else if (array.is_chunked())
+    {
+        std::vector<const uint8_t *> chunk_blocks;
+        for (auto source : array.chunk_sources)
+        {
+            chunk_blocks.push_back(get_block(source));
+        }
+
+        array.set_chunk_blocks(chunk_blocks, file_data);
+    }
+    else
+    {
+        array.set_array_block(get_block(array.get_source()), file_data);
+    }
+}
+
+GenericNDArray AsdfFile::get_generic_array(Node node) const
+{
+    auto array = node.as<GenericNDArray>();
+    attach_blocks(array);
+
+    return array;
+}
+
+void AsdfFile::set_num_threads(size_t num_threads)
+{
+    this->num_threads = num_threads;
+    thread_pool = nullptr;
+}
+
+void AsdfFile::set_parallel_write(bool enable, size_t max_in_flight)
+{
+    this->parallel_write = enable;
+    this->max_in_flight = max_in_flight;
+}
+
+void AsdfFile::set_thread_pool(std::shared_ptr<ThreadPool> pool)
+{
+    thread_pool = pool;
+}
+
+ThreadPool &AsdfFile::get_thread_pool() const
+{
+    if (thread_pool == nullptr)
+    {
+        thread_pool = std::make_shared<ThreadPool>(num_threads);
+    }
+
+    return *thread_pool;
+}
+
+std::string AsdfFile::get_filename()
+{
+    return filename;
+}
+
 Node AsdfFile::get_tree()
 {
     return asdf_tree;
@@ -205,27 +402,362 @@ Node AsdfFile::operator[] (std::string key)
     return asdf_tree[key];
 }
 
-void AsdfFile::write_blocks(std::ostream &ostream) const
+void AsdfFile::write_blocks(std::ostream &ostream, size_t offset,
+                            const std::vector<int> &duplicates) const
 {
-    block_manager.write_blocks(ostream);
+    if (parallel_write)
+    {
+        block_manager.write_blocks(ostream, offset, duplicates,
+                                   get_thread_pool(), max_in_flight);
+    }
+    else
+    {
+        /* Pipes, sockets and the like report a position of -1 */
+        const bool seekable = ostream.tellp() != std::streampos(-1);
+        block_manager.write_blocks(ostream, offset, duplicates, seekable);
+    }
+}
 
-    /* TODO: write block index here as well */
+void AsdfFile::set_checksums(bool enable)
+{
+    block_manager.set_checksums(enable);
 }
 
-std::ostream& operator<<(std::ostream& stream, const AsdfFile &af)
+void AsdfFile::set_block_dedup(DedupMode mode)
+{
+    block_manager.set_dedup(mode);
+}
+
+void AsdfFile::set_inline_threshold(size_t max_elements)
+{
+    inline_threshold = max_elements;
+}
+
+std::vector<int> AsdfFile::verify_checksums() const
+{
+    return verify_checksums_async().get();
+}
+
+std::future<std::vector<int>> AsdfFile::verify_checksums_async() const
+{
+    /* Resolving the blocks up front also validates a block index */
+    std::vector<const uint8_t *> block_list;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        block_list.push_back(get_block(i));
+    }
+
+    get_thread_pool();
+    std::shared_ptr<ThreadPool> pool = thread_pool;
+    std::shared_ptr<FileData> file_data = this->file_data;
+
+    /*
+     * The blocks are checked on the pool, but waiting for them happens on a
+     * separate thread so that a small pool can't deadlock.
+     */
+    return std::async(std::launch::async, [block_list, pool, file_data]()
+    {
+        std::vector<std::future<bool>> results;
+        for (auto block : block_list)
+        {
+            results.push_back(pool->submit([block]() {
+                return verify_block_checksum(block);
+            }));
+        }
+
+        for (auto &result : results)
+        {
+            result.wait();
+        }
+
+        std::vector<int> corrupt;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            if (not results[i].get())
+            {
+                corrupt.push_back(i);
+            }
+        }
+
+        return corrupt;
+    });
+}
+
+void AsdfFile::set_padding(size_t tree_padding, double block_headroom)
+{
+    this->tree_padding = tree_padding;
+    block_manager.set_block_headroom(block_headroom);
+}
+
+bool AsdfFile::update_tree()
+{
+    if (file_data == nullptr or not file_data->is_writable())
+    {
+        throw std::runtime_error("File was not opened for writing");
+    }
+
+    if (block_manager.get_length() > 0 or block_manager.has_streamed_block())
+    {
+        throw std::runtime_error("Can't add new arrays when updating the tree");
+    }
+
+    /* The tree may use everything up to the first block */
+    if (blocks.empty())
+    {
+        find_blocks();
+    }
+
+    const size_t available = blocks.empty() ? data_size : blocks.front() - data;
+
+    const std::string tree_data = render_tree(std::vector<int>());
+    if (tree_data.size() > available)
+    {
+        return false;
+    }
+
+    memcpy(data, tree_data.data(), tree_data.size());
+    memset(data + tree_data.size(), 0, available - tree_data.size());
+    file_data->sync(0, available);
+
+    end_index = tree_data.size();
+
+    return true;
+}
+
+bool AsdfFile::update_block(int source, const void *block_data, size_t size,
+                            CompressionOptions compression)
+{
+    if (file_data == nullptr or not file_data->is_writable())
+    {
+        throw std::runtime_error("File was not opened for writing");
+    }
+
+    uint8_t *block = data + (get_block(source) - data);
+    block_header_t *header = (block_header_t *) block;
+    uint8_t *block_start = block + header->total_header_size();
+
+    if (header->is_streamed())
+    {
+        throw std::runtime_error("Can't replace the data of a streamed block");
+    }
+
+    if (compression.shuffle != no_shuffle)
+    {
+        throw std::runtime_error("Can't shuffle data that replaces a block");
+    }
+
+    std::vector<uint8_t> encoded;
+    const uint8_t *stored = (const uint8_t *) block_data;
+    size_t stored_size = size;
+
+    if (compression.type != CompressionType::none)
+    {
+        compress_block_data(encoded, stored, size, compression);
+        stored = encoded.data();
+        stored_size = encoded.size();
+    }
+
+    const size_t allocated_size = header->get_allocated_size();
+    if (stored_size > allocated_size)
+    {
+        return false;
+    }
+
+    memcpy(block_start, stored, stored_size);
+    memset(block_start + stored_size, 0, allocated_size - stored_size);
+
+    header->set_compression(compression.type);
+    header->set_used_size(stored_size);
+    header->set_data_size(size);
+    update_block_checksum(block);
+
+    file_data->sync(block - data, header->total_header_size() + allocated_size);
+
+    return true;
+}
+
+void AsdfFile::append()
+{
+    if (file_data == nullptr or not file_data->is_writable())
+    {
+        throw std::runtime_error("File was not opened for writing");
+    }
+
+    if (block_manager.has_streamed_block())
+    {
+        throw std::runtime_error("Can't append a streamed array to a file");
+    }
+
+    /* New blocks start right after the space allocated for the last one */
+    size_t start = std::max(data_size, end_index);
+    size_t tree_limit = start;
+
+    if (not blocks.empty())
+    {
+        const block_header_t *last = (const block_header_t *) get_block(-1);
+        if (last->is_streamed())
+        {
+            throw std::runtime_error("Can't append to a file with a streamed array");
+        }
+
+        start = blocks.back() - data + last->total_header_size() +
+            last->get_allocated_size();
+        tree_limit = blocks.front() - data;
+    }
+
+    const std::vector<int> duplicates = block_manager.find_duplicates();
+    const std::string tree_data = render_tree(duplicates);
+    if (tree_data.size() > tree_limit)
+    {
+        throw std::runtime_error(
+            "Tree does not fit in the space reserved for it: "
+            "the file must be rewritten");
+    }
+
+    std::fstream stream(filename,
+                        std::ios::in | std::ios::out | std::ios::binary);
+    if (not stream)
+    {
+        throw std::runtime_error("Error opening " + filename + " for append");
+    }
+
+    /* The new block index replaces the old one */
+    stream.seekp(start);
+    write_blocks(stream, start, duplicates);
+    const size_t end = stream.tellp();
+
+    /* The tree is written last so that it never refers to missing blocks */
+    stream.seekp(0);
+    stream.write(tree_data.data(), tree_data.size());
+    write_padding(stream, tree_limit - tree_data.size());
+    stream.close();
+
+    if (stream.fail())
+    {
+        throw std::runtime_error("Error appending to " + filename);
+    }
+
+    if (truncate(filename.c_str(), end) != 0)
+    {
+        std::string msg("Error truncating " + filename + ": ");
+        throw std::runtime_error(msg + strerror(errno));
+    }
+
+    open_file();
+}
+
+/* Points the arrays in the tree at the blocks that are actually written */
+static void remap_sources(Node node, const std::vector<int> &sources)
+{
+    auto remap = [&sources](Node source) {
+        int value;
+        if (source.IsScalar() and YAML::convert<int>::decode(source, value) and
+            value >= 0 and value < (int) sources.size())
+        {
+            source = sources[value];
+        }
+    };
+
+    const std::string tag = node.Tag();
+    if (tag == NDARRAY_TAG or tag == SHUFFLED_NDARRAY_TAG)
+    {
+        if (node["source"])
+        {
+            remap(node["source"]);
+        }
+    }
+    else if (tag == CHUNKED_NDARRAY_TAG)
+    {
+        for (auto chunk : node["chunks"])
+        {
+            remap(chunk);
+        }
+    }
+
+    if (node.IsMap())
+    {
+        for (auto it : node)
+        {
+            remap_sources(it.second, sources);
+        }
+    }
+    else if (node.IsSequence())
+    {
+        for (auto it : node)
+        {
+            remap_sources(it, sources);
+        }
+    }
+}
+
+std::string AsdfFile::render_tree(const std::vector<int> &duplicates) const
 {
-    stream << ASDF_HEADER << " " << ASDF_FILE_FORMAT_VERSION << std::endl;
-    stream << ASDF_STANDARD_HEADER << " " << ASDF_STANDARD_VERSION << std::endl;
-    stream << "%YAML 1.1" << std::endl;
-    stream << "%TAG ! tag:stsci.edu:asdf/" << std::endl;
+    std::stringstream tree;
+
+    tree << ASDF_HEADER << " " << ASDF_FILE_FORMAT_VERSION << std::endl;
+    tree << ASDF_STANDARD_HEADER << " " << ASDF_STANDARD_VERSION << std::endl;
+    tree << "%YAML 1.1" << std::endl;
+    tree << "%TAG ! tag:stsci.edu:asdf/" << std::endl;
     /* TODO: there may be a more general way to handle the top-level object */
-    stream << YAML_START_MARKER << " " << "!core/asdf-1.1.0" << std::endl;
+    tree << YAML_START_MARKER;
 
-    stream << af.asdf_tree;
+    /* A tree that was read from a file already carries the top-level tag */
+    const std::string tag = asdf_tree.Tag();
+    if (tag.empty() or tag == "?")
+    {
+        tree << " " << "!core/asdf-1.1.0";
+    }
 
-    stream << std::endl << YAML_END_MARKER << std::endl;
+    tree << std::endl;
 
-    af.write_blocks(stream);
+    bool deduplicated = false;
+    for (size_t i = 0; i < duplicates.size(); i++)
+    {
+        deduplicated = deduplicated or duplicates[i] != (int) i;
+    }
+
+    /* The tree of the file itself keeps referring to the original blocks */
+    if (deduplicated)
+    {
+        Node tree_copy = YAML::Clone(asdf_tree);
+        remap_sources(tree_copy, block_manager.map_sources(duplicates));
+        tree << tree_copy;
+    }
+    else
+    {
+        tree << asdf_tree;
+    }
+
+    tree << std::endl << YAML_END_MARKER << std::endl;
+
+    return tree.str();
+}
+
+void AsdfFile::write_to(std::string filename, bool direct_io) const
+{
+    FileWriter writer(filename, direct_io);
+    writer.reserve(block_manager.get_storage_size() + (1ul << 16));
+
+    /* Make errors from the writer propagate instead of setting badbit */
+    std::ostream stream(&writer);
+    stream.exceptions(std::ios::badbit);
+
+    stream << *this;
+    writer.close();
+}
+
+std::ostream& operator<<(std::ostream& stream, const AsdfFile &af)
+{
+    /*
+     * The tree is rendered up front so that we know where the blocks start,
+     * which is needed for the block index.
+     */
+    const std::vector<int> duplicates = af.block_manager.find_duplicates();
+    const std::string tree_data = af.render_tree(duplicates);
+    stream.write(tree_data.data(), tree_data.size());
+    write_padding(stream, af.tree_padding);
+
+    af.write_blocks(stream, tree_data.size() + af.tree_padding, duplicates);
 
     return stream;
 }
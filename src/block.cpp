@@ -1,4 +1,6 @@
 #include <string>
+#include <algorithm>
+#include <streambuf>
 #include <cstdint>
 #include <cstring>
 #include <stdexcept>
@@ -10,44 +12,37 @@
 #include <error.h>
 #endif
 
+#include <yaml-cpp/yaml.h>
+
 #include <asdf-cpp/block.hpp>
 #include <asdf-cpp/compression.hpp>
 #include <asdf-cpp/private/compression.hpp>
+#include <asdf-cpp/private/md5.hpp>
 
 
-#if defined HAS_ZLIB || defined HAS_BZIP2
-static void * process_compressed_data(
-        const uint8_t *data,
-        size_t input_size,
-        size_t output_size,
-        CompressionType compression)
-{
-        /* Allocate enough memory to contain the uncompressed data */
-        uint8_t *output = (uint8_t *) malloc(output_size);
-        if (output == nullptr)
-        {
-            std::string msg = "Unable to allocate memory for uncompressed data";
-            throw std::runtime_error(msg + strerror(errno));
-        }
-
-        decompress_block(output, output_size, data, input_size, compression);
-        return (void *) output;
-}
-#endif
-
-void * process_block_data(const uint8_t *block_data)
+/*
+ * Decodes the data of the given block into the buffer provided by the
+ * caller, which must be at least as large as the block's data size.
+ */
+void read_block_data(const uint8_t *block_data, void *output, size_t capacity)
 {
     const block_header_t *header = (const block_header_t *) block_data;
     const uint8_t *data = block_data + header->total_header_size();
     const size_t data_size = header->get_data_size();
     const size_t comp_field_size = sizeof(header->compression);
 
+    if (capacity < data_size)
+    {
+        throw std::runtime_error("Buffer is too small to hold block data");
+    }
 
     if (memcmp(header->compression, "zlib", comp_field_size) == 0)
     {
 #ifdef HAS_ZLIB
         const size_t used_size = header->get_used_size();
-        return process_compressed_data(data, used_size, data_size, CompressionType::zlib);
+        decompress_block((uint8_t *) output, data_size, data, used_size,
+                         CompressionType::zlib);
+        return;
 #else
         std::string msg("Can't read zlib block: zlib is not installed");
         throw std::runtime_error(msg);
@@ -57,10 +52,36 @@ void * process_block_data(const uint8_t *block_data)
     {
 #ifdef HAS_BZIP2
         const size_t used_size = header->get_used_size();
-        return process_compressed_data(data, used_size, data_size, CompressionType::bzip2);
+        decompress_block((uint8_t *) output, data_size, data, used_size,
+                         CompressionType::bzip2);
+        return;
 #else
         std::string msg("Can't read bzp2 block: bzip is not installed");
         throw std::runtime_error(msg);
+#endif
+    }
+    else if (memcmp(header->compression, zstd_compression, comp_field_size) == 0)
+    {
+#ifdef HAS_ZSTD
+        const size_t used_size = header->get_used_size();
+        decompress_block((uint8_t *) output, data_size, data, used_size,
+                         CompressionType::zstd);
+        return;
+#else
+        std::string msg("Can't read zstd block: zstd is not installed");
+        throw std::runtime_error(msg);
+#endif
+    }
+    else if (memcmp(header->compression, lz4_compression, comp_field_size) == 0)
+    {
+#ifdef HAS_LZ4
+        const size_t used_size = header->get_used_size();
+        decompress_block((uint8_t *) output, data_size, data, used_size,
+                         CompressionType::lz4);
+        return;
+#else
+        std::string msg("Can't read lz4 block: lz4 is not installed");
+        throw std::runtime_error(msg);
 #endif
     }
     else if (memcmp(header->compression, no_compression, comp_field_size) != 0)
@@ -70,18 +91,393 @@ void * process_block_data(const uint8_t *block_data)
     }
 
     /* Handle the uncompressed case: simply make a copy of the data block */
-    uint8_t *data_copy = (uint8_t *) malloc(data_size);
-    memcpy(data_copy, data, data_size);
+    memcpy(output, data, data_size);
+}
+
+/*
+ * Decodes the data of the given block a window at a time, so that each window
+ * can be post-processed (e.g. byteswapped into its final place) while it is
+ * still in cache. Every window is a multiple of alignment bytes in size,
+ * except possibly the last. Uncompressed data is passed on as a single window
+ * that points into the block itself.
+ */
+void read_block_windows(const uint8_t *block_data, size_t alignment,
+                        const WindowConsumer &consume)
+{
+    const block_header_t *header = (const block_header_t *) block_data;
+    const uint8_t *data = block_data + header->total_header_size();
+    const size_t data_size = header->get_data_size();
+
+    CompressionType compression = header->get_compression();
+    if (compression == unknown)
+    {
+        std::string msg("Unrecognized or unsupported compression algorithm");
+        throw std::runtime_error(msg);
+    }
+
+    if (compression == none)
+    {
+        consume(data, 0, data_size);
+        return;
+    }
 
-    return (void *) data_copy;
+    decompress_block_windows(data, header->get_used_size(), data_size,
+                             compression, alignment, consume);
 }
 
+/* The returned buffer is allocated with malloc and must be released with free */
+void * process_block_data(const uint8_t *block_data)
+{
+    const block_header_t *header = (const block_header_t *) block_data;
+    const size_t data_size = header->get_data_size();
+
+    /* Allocate enough memory to contain the uncompressed data */
+    void *output = malloc(data_size);
+    if (output == nullptr)
+    {
+        std::string msg = "Unable to allocate memory for block data: ";
+        throw std::runtime_error(msg + strerror(errno));
+    }
+
+    try
+    {
+        read_block_data(block_data, output, data_size);
+    }
+    catch (...)
+    {
+        free(output);
+        throw;
+    }
+
+    return output;
+}
+
+void compute_checksum(uint8_t checksum[16], const uint8_t *data, size_t size)
+{
+    Asdf::MD5 md5;
+    md5.update(data, size);
+    md5.finish(checksum);
+}
+
+/*
+ * Recomputes the checksum of the block's used data and stores it in the
+ * block header. Used after a block has been modified in place.
+ */
+void update_block_checksum(uint8_t *block_data)
+{
+    block_header_t *header = (block_header_t *) block_data;
+    compute_checksum(header->checksum, block_data + header->total_header_size(),
+                     header->get_used_size());
+}
+
+/*
+ * Checks the used data of the block against the checksum in its header. A
+ * checksum of all zeros means that none was recorded, which always passes.
+ */
+bool verify_block_checksum(const uint8_t *block_data)
+{
+    const block_header_t *header = (const block_header_t *) block_data;
+    const uint8_t zeros[sizeof(header->checksum)] = { 0 };
+
+    if (memcmp(header->checksum, zeros, sizeof(zeros)) == 0)
+    {
+        return true;
+    }
+
+    uint8_t checksum[sizeof(header->checksum)];
+    compute_checksum(checksum, block_data + header->total_header_size(),
+                     header->get_used_size());
+
+    return memcmp(header->checksum, checksum, sizeof(checksum)) == 0;
+}
+
+namespace {
+/*
+ * Forwards everything written to it to another streambuf while computing
+ * its checksum, so that compressed output is hashed as it is produced.
+ */
+class HashingStreamBuf : public std::streambuf
+{
+    public:
+        HashingStreamBuf(std::streambuf *target) : target(target) {}
+
+        void finish(uint8_t checksum[16])
+        {
+            md5.finish(checksum);
+        }
+
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize n)
+        {
+            md5.update(s, n);
+            return target->sputn(s, n);
+        }
+
+        int_type overflow(int_type c)
+        {
+            if (c != traits_type::eof())
+            {
+                char ch = (char) c;
+                md5.update(&ch, 1);
+                return target->sputc(ch);
+            }
+
+            return traits_type::not_eof(c);
+        }
+
+    private:
+        std::streambuf *target;
+        Asdf::MD5 md5;
+};
+}
+
+/* The checksum of the compressed data is stored in checksum if given */
 void write_compressed_block(
         std::ostream &stream,
         size_t *compressed_size,
         const uint8_t *raw_data,
         size_t data_size,
-        CompressionType compression)
+        const CompressionOptions &compression,
+        uint8_t *checksum,
+        const InputFilter &filter)
 {
-    compress_and_write_block(stream, compressed_size, raw_data, data_size, compression); 
+    if (checksum == nullptr)
+    {
+        compress_and_write_block(stream, compressed_size, raw_data, data_size,
+                                 compression, filter);
+        return;
+    }
+
+    HashingStreamBuf hashing(stream.rdbuf());
+    std::ostream hashed(&hashing);
+    hashed.exceptions(std::ios::badbit);
+
+    compress_and_write_block(hashed, compressed_size, raw_data, data_size,
+                             compression, filter);
+    hashing.finish(checksum);
+}
+
+namespace {
+/* An output streambuf that appends everything written to it to a vector */
+class VectorStreamBuf : public std::streambuf
+{
+    public:
+        VectorStreamBuf(std::vector<uint8_t> &output) : output(output) {}
+
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize n)
+        {
+            output.insert(output.end(), (const uint8_t *) s,
+                          (const uint8_t *) s + n);
+            return n;
+        }
+
+        int_type overflow(int_type c)
+        {
+            if (c != traits_type::eof())
+            {
+                output.push_back((uint8_t) c);
+            }
+
+            return c;
+        }
+
+    private:
+        std::vector<uint8_t> &output;
+};
+}
+
+/*
+ * Compresses the given data into a buffer in memory. This allows blocks to be
+ * compressed ahead of the point where they are written to the output.
+ */
+void compress_block_data(
+        std::vector<uint8_t> &output,
+        const uint8_t *raw_data,
+        size_t data_size,
+        const CompressionOptions &compression,
+        uint8_t *checksum,
+        const InputFilter &filter)
+{
+    VectorStreamBuf buffer(output);
+    std::ostream stream(&buffer);
+    size_t compressed_size = 0;
+
+    output.clear();
+    write_compressed_block(stream, &compressed_size, raw_data, data_size,
+                           compression, checksum, filter);
+}
+
+/*
+ * Passes data through the given filter a window at a time, using a staging
+ * buffer of bounded size, and hands each filtered window to consume. Without
+ * a filter, the windows are handed over as they are.
+ */
+static void filter_windows(
+        const uint8_t *data,
+        size_t size,
+        const InputFilter &filter,
+        const std::function<void(const uint8_t *, size_t)> &consume)
+{
+    uint8_t *staging = thread_buffer(filter_role, FILTER_WINDOW_SIZE);
+
+    for (size_t offset = 0; offset < size; offset += FILTER_WINDOW_SIZE)
+    {
+        const size_t count = std::min(size - offset, FILTER_WINDOW_SIZE);
+        if (not filter)
+        {
+            consume(data + offset, count);
+            continue;
+        }
+
+        filter(staging, data + offset, count);
+        consume(staging, count);
+    }
+}
+
+/* Computes the checksum of data as it is after the given filter */
+void compute_filtered_checksum(
+        uint8_t checksum[16],
+        const uint8_t *data,
+        size_t size,
+        const InputFilter &filter)
+{
+    Asdf::MD5 md5;
+
+    filter_windows(data, size, filter,
+        [&md5](const uint8_t *window, size_t count)
+        {
+            md5.update(window, count);
+        });
+
+    md5.finish(checksum);
+}
+
+/*
+ * Writes data to the stream after passing it through the given filter. If a
+ * checksum is requested, each window is hashed right before it is written,
+ * while it is still in the cache.
+ */
+void write_filtered_data(
+        std::ostream &stream,
+        const uint8_t *data,
+        size_t size,
+        const InputFilter &filter,
+        uint8_t *checksum)
+{
+    Asdf::MD5 md5;
+
+    filter_windows(data, size, filter,
+        [&stream, &md5, checksum](const uint8_t *window, size_t count)
+        {
+            if (checksum != nullptr)
+            {
+                md5.update(window, count);
+            }
+
+            stream.write((const char *) window, count);
+        });
+
+    if (checksum != nullptr)
+    {
+        md5.finish(checksum);
+    }
+}
+
+/* Writes the given number of zero bytes, e.g. to fill unused block space */
+void write_padding(std::ostream &stream, size_t size)
+{
+    static const char zeros[4096] = { 0 };
+
+    while (size > 0)
+    {
+        const size_t count = std::min(size, sizeof(zeros));
+        stream.write(zeros, count);
+        size -= count;
+    }
+}
+
+void write_block_index(std::ostream &stream, const std::vector<size_t> &offsets)
+{
+    /* Avoid std::endl here since flushing is costly on unbuffered sinks */
+    stream << BLOCK_INDEX_HEADER << "\n";
+    stream << "%YAML 1.1" << "\n";
+    stream << "--- [";
+
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        stream << (i ? ", " : "") << offsets[i];
+    }
+
+    stream << "]\n" << "...\n";
+}
+
+static inline bool is_index_char(uint8_t c)
+{
+    return (c >= 0x20 && c < 0x7f) || c == '\n' || c == '\r' || c == '\t';
+}
+
+/*
+ * The block index must be the very last thing in the file, so we scan
+ * backwards from the end and give up as soon as we see a byte that can't be
+ * part of the index text. This keeps files without an index from causing a
+ * scan through the block data.
+ */
+static const uint8_t *find_block_index(const uint8_t *begin, const uint8_t *end)
+{
+    const size_t header_len = strlen(BLOCK_INDEX_HEADER);
+
+    for (const uint8_t *current = end; current > begin; current--)
+    {
+        const uint8_t c = current[-1];
+
+        if (not is_index_char(c))
+        {
+            return nullptr;
+        }
+
+        if (c == '#' && (size_t) (end - current + 1) >= header_len &&
+            memcmp(current - 1, BLOCK_INDEX_HEADER, header_len) == 0)
+        {
+            return current - 1;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Reads the block offsets from the index at the end of the given region.
+ * Returns a pointer to the start of the index, or nullptr if there is no
+ * index or it can't be parsed. The offsets themselves are not validated.
+ */
+const uint8_t *read_block_index(
+        std::vector<size_t> &offsets,
+        const uint8_t *begin,
+        const uint8_t *end)
+{
+    const uint8_t *index = find_block_index(begin, end);
+    if (index == nullptr)
+    {
+        return nullptr;
+    }
+
+    /* Skip the index header line since it isn't part of the YAML document */
+    const uint8_t *yaml = (const uint8_t *) memchr(index, '\n', end - index);
+    if (yaml == nullptr)
+    {
+        return nullptr;
+    }
+
+    try
+    {
+        std::string text((const char *) yaml + 1, end - yaml - 1);
+        offsets = YAML::Load(text).as<std::vector<size_t>>();
+    }
+    catch (const YAML::Exception &)
+    {
+        return nullptr;
+    }
+
+    return index;
 }
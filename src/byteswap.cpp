@@ -0,0 +1,244 @@
+#include <string>
+#include <vector>
+#include <future>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <asdf-cpp/byteswap.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ASDF_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Each thread swaps at least this many bytes, so that only buffers that take
+ * much longer to swap than to hand out to the pool are split.
+ */
+#define BYTESWAP_BYTES_PER_THREAD   (1ul << 22)
+
+namespace {
+
+/* Each kernel returns the number of bytes it handled, from the start */
+typedef size_t (*swap_kernel_t)(uint8_t *, const uint8_t *, size_t, size_t);
+
+void swap_scalar(uint8_t *dst, const uint8_t *src, size_t count,
+                 size_t elem_size)
+{
+    /* memcpy keeps this safe for unaligned buffers */
+    switch (elem_size)
+    {
+        case 2:
+            for (size_t i = 0; i < count; i++)
+            {
+                uint16_t word;
+                memcpy(&word, src + 2 * i, 2);
+                word = bswap_16(word);
+                memcpy(dst + 2 * i, &word, 2);
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < count; i++)
+            {
+                uint32_t word;
+                memcpy(&word, src + 4 * i, 4);
+                word = bswap_32(word);
+                memcpy(dst + 4 * i, &word, 4);
+            }
+            break;
+        case 8:
+            for (size_t i = 0; i < count; i++)
+            {
+                uint64_t word;
+                memcpy(&word, src + 8 * i, 8);
+                word = bswap_64(word);
+                memcpy(dst + 8 * i, &word, 8);
+            }
+            break;
+        default:
+            throw std::runtime_error(
+                "Can't byteswap elements of " + std::to_string(elem_size) +
+                " bytes");
+    }
+}
+
+#ifdef ASDF_X86_SIMD
+
+/*
+ * The pshufb control that reverses each element of a vector. Only the low
+ * four bits of each byte are used, which index into the same 128-bit lane.
+ */
+void make_swap_mask(uint8_t *mask, size_t size, size_t elem_size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        mask[i] = (i / elem_size) * elem_size + (elem_size - 1 - i % elem_size);
+    }
+}
+
+__attribute__((target("ssse3")))
+size_t swap_ssse3(uint8_t *dst, const uint8_t *src, size_t size,
+                  size_t elem_size)
+{
+    uint8_t bytes[16];
+    make_swap_mask(bytes, sizeof(bytes), elem_size);
+    const __m128i mask = _mm_loadu_si128((const __m128i *) bytes);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, mask));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t swap_avx2(uint8_t *dst, const uint8_t *src, size_t size,
+                 size_t elem_size)
+{
+    uint8_t bytes[32];
+    make_swap_mask(bytes, sizeof(bytes), elem_size);
+    const __m256i mask = _mm256_loadu_si256((const __m256i *) bytes);
+
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, mask));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_shuffle_epi8(b, mask));
+    }
+
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t swap_avx512(uint8_t *dst, const uint8_t *src, size_t size,
+                   size_t elem_size)
+{
+    uint8_t bytes[64];
+    make_swap_mask(bytes, sizeof(bytes), elem_size);
+    const __m512i mask = _mm512_loadu_si512((const void *) bytes);
+
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void *)(src + i));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_shuffle_epi8(v, mask));
+    }
+
+    return i;
+}
+
+swap_kernel_t select_kernel(void)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512bw"))
+    {
+        return swap_avx512;
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        return swap_avx2;
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        return swap_ssse3;
+    }
+
+    return nullptr;
+}
+
+#else
+
+swap_kernel_t select_kernel(void)
+{
+    return nullptr;
+}
+
+#endif /* ASDF_X86_SIMD */
+
+void swap_range(uint8_t *dst, const uint8_t *src, size_t count,
+                size_t elem_size)
+{
+    static const swap_kernel_t kernel = select_kernel();
+
+    size_t done = 0;
+    if (kernel != nullptr && elem_size > 1 && elem_size <= 8)
+    {
+        done = kernel(dst, src, count * elem_size, elem_size) / elem_size;
+    }
+
+    swap_scalar(dst + done * elem_size, src + done * elem_size,
+                count - done, elem_size);
+}
+
+} /* namespace */
+
+void byteswap_copy(void *dst, const void *src, size_t count, size_t elem_size,
+                   Asdf::ThreadPool *pool)
+{
+    uint8_t *out = (uint8_t *) dst;
+    const uint8_t *in = (const uint8_t *) src;
+
+    /* The calling thread takes a part as well */
+    size_t num_parts = 1;
+    if (pool != nullptr and not Asdf::ThreadPool::in_worker())
+    {
+        num_parts = std::min(pool->get_num_threads() + 1,
+                             count * elem_size / BYTESWAP_BYTES_PER_THREAD);
+    }
+
+    if (num_parts < 2)
+    {
+        swap_range(out, in, count, elem_size);
+        return;
+    }
+
+    const size_t part = (count + num_parts - 1) / num_parts;
+
+    std::vector<std::future<void>> futures;
+    for (size_t start = part; start < count; start += part)
+    {
+        const size_t length = std::min(part, count - start);
+        futures.push_back(pool->submit([=]() {
+            swap_range(out + start * elem_size, in + start * elem_size,
+                       length, elem_size);
+        }));
+    }
+
+    try
+    {
+        swap_range(out, in, part, elem_size);
+    }
+    catch (...)
+    {
+        for (auto &future : futures)
+        {
+            future.wait();
+        }
+
+        throw;
+    }
+
+    for (auto &future : futures)
+    {
+        future.get();
+    }
+}
+
+void byteswap_buffer(void *data, size_t count, size_t elem_size,
+                     Asdf::ThreadPool *pool)
+{
+    byteswap_copy(data, data, count, elem_size, pool);
+}
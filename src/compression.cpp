@@ -2,15 +2,12 @@
 #include <cstring>              // for strerror
 #include <cstdint>
 #include <stdexcept>
+#include <algorithm>
+#include <vector>
 
 #include <asdf-cpp/compression.hpp>
 #include <asdf-cpp/private/compression.hpp>
 
-/*
- * This is fairly arbitrary right now and eventually could be configured to
- * balance performance and memory usage.
- */
-#define OUTPUT_BUFF_SIZE    (1ul << 16)
 #define PACK_U64(HI, LO)    (((uint64_t) HI << 32) | LO)
 
 
@@ -21,13 +18,22 @@ static int zlib_compress(
     std::ostream &stream,
     size_t *output_size,
     const uint8_t *input,
-    size_t input_size);
+    size_t input_size,
+    const CompressionOptions &options,
+    const InputFilter &filter);
 
 static int zlib_decompress(
     uint8_t *output,
     size_t output_size,
     const uint8_t *input,
     size_t input_size);
+
+static int zlib_decompress_windows(
+    const uint8_t *input,
+    size_t input_size,
+    size_t output_size,
+    size_t alignment,
+    const WindowConsumer &consume);
 #endif
 
 #ifdef HAS_BZIP2
@@ -37,13 +43,80 @@ static int bzip2_compress(
     std::ostream &stream,
     size_t *output_size,
     const uint8_t *input,
-    size_t input_size);
+    size_t input_size,
+    const CompressionOptions &options,
+    const InputFilter &filter);
 
 static int bzip2_decompress(
     uint8_t *output,
     size_t output_size,
     const uint8_t *input,
     size_t input_size);
+
+static int bzip2_decompress_windows(
+    const uint8_t *input,
+    size_t input_size,
+    size_t output_size,
+    size_t alignment,
+    const WindowConsumer &consume);
+#endif
+
+
+#ifdef HAS_ZSTD
+#include <zstd.h>
+
+static int zstd_compress(
+    std::ostream &stream,
+    size_t *output_size,
+    const uint8_t *input,
+    size_t input_size,
+    const CompressionOptions &options,
+    const InputFilter &filter);
+
+static int zstd_decompress(
+    uint8_t *output,
+    size_t output_size,
+    const uint8_t *input,
+    size_t input_size);
+
+static int zstd_decompress_windows(
+    const uint8_t *input,
+    size_t input_size,
+    size_t output_size,
+    size_t alignment,
+    const WindowConsumer &consume);
+#endif
+
+#ifdef HAS_LZ4
+#include <lz4.h>
+
+/*
+ * The lz4 data of a block is split into chunks of this size, as in the Python
+ * implementation of ASDF. Each chunk is stored with a big-endian length
+ * prefix, followed by the little-endian size of its uncompressed data.
+ */
+#define ASDF_LZ4_CHUNK_SIZE (1ul << 22)
+
+static int lz4_compress(
+    std::ostream &stream,
+    size_t *output_size,
+    const uint8_t *input,
+    size_t input_size,
+    const CompressionOptions &options,
+    const InputFilter &filter);
+
+static int lz4_decompress(
+    uint8_t *output,
+    size_t output_size,
+    const uint8_t *input,
+    size_t input_size);
+
+static int lz4_decompress_windows(
+    const uint8_t *input,
+    size_t input_size,
+    size_t output_size,
+    size_t alignment,
+    const WindowConsumer &consume);
 #endif
 
 
@@ -63,20 +136,309 @@ static int bzip2_decompress(
     }                                               \
 }
 
+#define CHECK_ZSTD_ERR(expr) {                      \
+    const size_t zstd_ret = (expr);                 \
+    if (ZSTD_isError(zstd_ret))                     \
+    {                                               \
+        std::string output = "zstd error: ";        \
+        output += ZSTD_getErrorName(zstd_ret);      \
+        throw std::runtime_error(output);           \
+    }                                               \
+}
+
+/*
+ * Codec contexts and scratch buffers are expensive to set up relative to a
+ * small block, so each thread keeps its own and reuses them from one block to
+ * the next. They are released when the thread exits.
+ */
+uint8_t *thread_buffer(BufferRole role, size_t size)
+{
+    thread_local std::vector<uint8_t> buffers[num_buffer_roles];
+    std::vector<uint8_t> &buffer = buffers[role];
+
+    if (buffer.size() < size)
+    {
+        buffer.resize(size);
+    }
+
+    return buffer.data();
+}
+
+namespace {
+/*
+ * Hands out the input of a compressor a window at a time. With a filter, each
+ * window is transformed into a staging buffer first, so the filtered data
+ * never takes up more memory than one window.
+ */
+class InputWindows
+{
+    public:
+        InputWindows(const uint8_t *input, size_t input_size,
+                     const InputFilter &filter, size_t window_size = 0) :
+            input(input), input_size(input_size), filter(filter)
+        {
+            /* Unfiltered input is also split so that zlib's counters fit */
+            if (window_size == 0)
+            {
+                window_size = filter ? FILTER_WINDOW_SIZE : (1ul << 30);
+            }
+
+            this->window_size = window_size;
+        }
+
+        bool next(const uint8_t **window, size_t *size)
+        {
+            if (offset >= input_size)
+            {
+                return false;
+            }
+
+            *size = std::min(window_size, input_size - offset);
+
+            if (filter)
+            {
+                uint8_t *staging = thread_buffer(staging_role, window_size);
+                filter(staging, input + offset, *size);
+                *window = staging;
+            }
+            else
+            {
+                *window = input + offset;
+            }
+
+            offset += *size;
+            return true;
+        }
+
+    private:
+        const uint8_t *input;
+        size_t input_size;
+        const InputFilter &filter;
+        size_t window_size;
+        size_t offset = 0;
+};
+}
+
+/* The largest multiple of alignment that is no larger than a window */
+static size_t window_size_for(size_t alignment)
+{
+    if (alignment == 0 || alignment >= DECOMPRESS_WINDOW_SIZE)
+    {
+        return std::max(alignment, (size_t) DECOMPRESS_WINDOW_SIZE);
+    }
+
+    return DECOMPRESS_WINDOW_SIZE - DECOMPRESS_WINDOW_SIZE % alignment;
+}
+
+#ifdef HAS_ZLIB
+namespace {
+class ZlibContexts
+{
+    public:
+        ~ZlibContexts(void)
+        {
+            discard_deflater();
+            discard_inflater();
+        }
+
+        /* Returns a deflate stream that is ready for a new block */
+        z_stream &get_deflater(int level, int strategy)
+        {
+            int ret;
+
+            if (deflate_ready && level == deflate_level &&
+                strategy == deflate_strategy)
+            {
+                ret = deflateReset(&deflater);
+            }
+            else
+            {
+                discard_deflater();
+
+                deflater.zalloc = Z_NULL;
+                deflater.zfree = Z_NULL;
+                deflater.opaque = Z_NULL;
+                ret = deflateInit2(&deflater, level, Z_DEFLATED, MAX_WBITS, 8,
+                                   strategy);
+            }
+
+            CHECK_ZLIB_ERR(ret, "deflateInit");
+
+            deflate_ready = true;
+            deflate_level = level;
+            deflate_strategy = strategy;
+
+            return deflater;
+        }
+
+        /* Returns an inflate stream that is ready for a new block */
+        z_stream &get_inflater(void)
+        {
+            int ret;
+
+            if (inflate_ready)
+            {
+                ret = inflateReset(&inflater);
+            }
+            else
+            {
+                inflater.zalloc = Z_NULL;
+                inflater.zfree = Z_NULL;
+                inflater.opaque = Z_NULL;
+                inflater.next_in = Z_NULL;
+                inflater.avail_in = 0;
+                ret = inflateInit(&inflater);
+            }
+
+            CHECK_ZLIB_ERR(ret, "inflateInit");
+            inflate_ready = true;
+
+            return inflater;
+        }
+
+        /* After an error the stream is set up from scratch the next time */
+        void discard_deflater(void)
+        {
+            if (deflate_ready)
+            {
+                deflateEnd(&deflater);
+                deflate_ready = false;
+            }
+        }
+
+        void discard_inflater(void)
+        {
+            if (inflate_ready)
+            {
+                inflateEnd(&inflater);
+                inflate_ready = false;
+            }
+        }
+
+    private:
+        z_stream deflater;
+        z_stream inflater;
+        bool deflate_ready = false;
+        bool inflate_ready = false;
+        int deflate_level = 0;
+        int deflate_strategy = 0;
+};
+
+thread_local ZlibContexts zlib_contexts;
+}
+#endif
+
+#ifdef HAS_ZSTD
+namespace {
+class ZstdContexts
+{
+    public:
+        ~ZstdContexts(void)
+        {
+            ZSTD_freeCCtx(cctx);
+            ZSTD_freeDCtx(dctx);
+        }
+
+        ZSTD_CCtx *get_cctx(void)
+        {
+            if (cctx == nullptr)
+            {
+                cctx = ZSTD_createCCtx();
+                if (cctx == nullptr)
+                {
+                    throw std::runtime_error("zstd error: createCCtx");
+                }
+            }
+            else
+            {
+                ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+            }
+
+            return cctx;
+        }
+
+        ZSTD_DCtx *get_dctx(void)
+        {
+            if (dctx == nullptr)
+            {
+                dctx = ZSTD_createDCtx();
+                if (dctx == nullptr)
+                {
+                    throw std::runtime_error("zstd error: createDCtx");
+                }
+            }
+
+            return dctx;
+        }
+
+    private:
+        ZSTD_CCtx *cctx = nullptr;
+        ZSTD_DCtx *dctx = nullptr;
+};
+
+thread_local ZstdContexts zstd_contexts;
+}
+#endif
+
+bool is_compression_supported(CompressionType ct)
+{
+    switch (ct)
+    {
+        case zlib:
+#if HAS_ZLIB
+            return true;
+#else
+            return false;
+#endif
+        case bzip2:
+#if HAS_BZIP2
+            return true;
+#else
+            return false;
+#endif
+        case zstd:
+#if HAS_ZSTD
+            return true;
+#else
+            return false;
+#endif
+        case lz4:
+#if HAS_LZ4
+            return true;
+#else
+            return false;
+#endif
+        case none:
+            return true;
+        default:
+            break;
+    }
+
+    return false;
+}
+
 int compress_and_write_block(
         std::ostream &stream,
         size_t *output_size,
         const uint8_t *input,
         size_t input_size,
-        CompressionType compression)
+        const CompressionOptions &options,
+        const InputFilter &filter)
 {
     std::string msg;
 
-    switch (compression)
+    /* The codecs would never make progress without room for their output */
+    if (options.type != none && options.buffer_size == 0)
+    {
+        throw std::runtime_error("Compression buffer size must not be zero");
+    }
+
+    switch (options.type)
     {
         case zlib:
 #if HAS_ZLIB
-            return zlib_compress(stream, output_size, input, input_size);
+            return zlib_compress(stream, output_size, input, input_size, options,
+                                 filter);
 #else
             msg = "Can't compress block: zlib library is not installed";
             throw std::runtime_error(msg);
@@ -85,13 +447,34 @@ int compress_and_write_block(
 
         case bzip2:
 #if HAS_BZIP2
-            return bzip2_compress(stream, output_size, input, input_size);
+            return bzip2_compress(stream, output_size, input, input_size, options,
+                                 filter);
 #else
             msg = "Can't compress block: bzip2 library is not installed";
             throw std::runtime_error(msg);
 #endif
             break;
 
+        case zstd:
+#if HAS_ZSTD
+            return zstd_compress(stream, output_size, input, input_size, options,
+                                 filter);
+#else
+            msg = "Can't compress block: zstd library is not installed";
+            throw std::runtime_error(msg);
+#endif
+            break;
+
+        case lz4:
+#if HAS_LZ4
+            return lz4_compress(stream, output_size, input, input_size, options,
+                                 filter);
+#else
+            msg = "Can't compress block: lz4 library is not installed";
+            throw std::runtime_error(msg);
+#endif
+            break;
+
         case unknown:
             msg = "Can't compress block with unknown compression type";
             throw std::runtime_error(msg);
@@ -132,6 +515,24 @@ int decompress_block(
 #endif
             break;
 
+        case zstd:
+#if HAS_ZSTD
+            return zstd_decompress(output, output_size, input, input_size);
+#else
+            msg = "Can't decompress block: zstd library is not installed";
+            throw std::runtime_error(msg);
+#endif
+            break;
+
+        case lz4:
+#if HAS_LZ4
+            return lz4_decompress(output, output_size, input, input_size);
+#else
+            msg = "Can't decompress block: lz4 library is not installed";
+            throw std::runtime_error(msg);
+#endif
+            break;
+
         case unknown:
             msg = "Can't decompress block with unknown compression type";
             throw std::runtime_error(msg);
@@ -144,61 +545,121 @@ int decompress_block(
     return 0;
 }
 
+int decompress_block_windows(
+        const uint8_t *input,
+        size_t input_size,
+        size_t output_size,
+        CompressionType compression,
+        size_t alignment,
+        const WindowConsumer &consume)
+{
+    std::string msg;
+
+    switch (compression)
+    {
+        case zlib:
+#if HAS_ZLIB
+            return zlib_decompress_windows(input, input_size, output_size,
+                                           alignment, consume);
+#else
+            msg = "Can't decompress block: zlib library is not installed";
+            throw std::runtime_error(msg);
+#endif
+            break;
+
+        case bzip2:
+#if HAS_BZIP2
+            return bzip2_decompress_windows(input, input_size, output_size,
+                                            alignment, consume);
+#else
+            msg = "Can't decompress block: bzip2 library is not installed";
+            throw std::runtime_error(msg);
+#endif
+            break;
+
+        case zstd:
+#if HAS_ZSTD
+            return zstd_decompress_windows(input, input_size, output_size,
+                                           alignment, consume);
+#else
+            msg = "Can't decompress block: zstd library is not installed";
+            throw std::runtime_error(msg);
+#endif
+            break;
+
+        case lz4:
+#if HAS_LZ4
+            return lz4_decompress_windows(input, input_size, output_size,
+                                          alignment, consume);
+#else
+            msg = "Can't decompress block: lz4 library is not installed";
+            throw std::runtime_error(msg);
+#endif
+            break;
+
+        case unknown:
+            msg = "Can't decompress block with unknown compression type";
+            throw std::runtime_error(msg);
+
+        default:
+            consume(input, 0, output_size);
+            break;
+    }
+
+    return 0;
+}
+
 #ifdef HAS_ZLIB
 static int zlib_compress(
     std::ostream &ostream,
     size_t *output_size,
     const uint8_t *input,
-    size_t input_size)
+    size_t input_size,
+    const CompressionOptions &options,
+    const InputFilter &filter)
 {
     int ret;
-    z_stream c_stream;
-
-    /* Allocate temporary buffer for compressed data output */
-    /*
-     * TODO: consider using deflateBound to get an upper bound on this and just
-     * allocate it a single time and free.
-     */
-    Bytef *outbuf = (Bytef *) malloc(OUTPUT_BUFF_SIZE);
-    if (outbuf == nullptr)
-    {
-        std::string msg = "Failed to allocate temporary buffer for compressed output: ";
-        throw std::runtime_error(msg + strerror(errno));
-    }
 
-    c_stream.zalloc = Z_NULL;
-    c_stream.zfree = Z_NULL;
-    c_stream.next_in = (Bytef *) input;
-    c_stream.avail_in = input_size;
-    c_stream.next_out = outbuf;
-    c_stream.avail_out = OUTPUT_BUFF_SIZE;
+    const size_t buffer_size = options.buffer_size;
+    Bytef *outbuf = (Bytef *) thread_buffer(scratch_role, buffer_size);
 
-    ret = deflateInit(&c_stream, Z_DEFAULT_COMPRESSION);
-    if (ret != Z_OK)
-    {
-        free(outbuf);
-        throw std::runtime_error("zlib error: deflateInit");
-    }
+    const int level = (options.level == COMPRESSION_LEVEL_DEFAULT) ?
+        Z_DEFAULT_COMPRESSION : options.level;
+
+    z_stream &c_stream = zlib_contexts.get_deflater(level, options.strategy);
+    c_stream.next_out = outbuf;
+    c_stream.avail_out = buffer_size;
 
     size_t compressed_size = 0;
 
     /* Process all of the input */
-    while (c_stream.total_in < input_size)
+    InputWindows windows(input, input_size, filter);
+    const uint8_t *window;
+    size_t window_size;
+
+    ret = Z_OK;
+    while (windows.next(&window, &window_size))
     {
-        ret = deflate(&c_stream, Z_NO_FLUSH);
-        if (ret != Z_OK)
-        {
-            free(outbuf);
-            CHECK_ZLIB_ERR(ret, "deflate");
-        }
+        c_stream.next_in = (Bytef *) window;
+        c_stream.avail_in = window_size;
 
-        if (c_stream.avail_out == 0)
+        while (c_stream.avail_in > 0)
         {
-            ostream.write((const char *) outbuf, OUTPUT_BUFF_SIZE);
-            /* Reset to the beginning of the temporary buffer */
-            c_stream.next_out = outbuf;
-            c_stream.avail_out = OUTPUT_BUFF_SIZE;
-            compressed_size += OUTPUT_BUFF_SIZE;
+            ret = deflate(&c_stream, Z_NO_FLUSH);
+            if (ret != Z_OK)
+            {
+                zlib_contexts.discard_deflater();
+                CHECK_ZLIB_ERR(ret, "deflate");
+            }
+
+            if (c_stream.avail_out == 0)
+            {
+                ostream.write((const char *) outbuf, buffer_size);
+                /* Reset to the beginning of the temporary buffer */
+                c_stream.next_out = outbuf;
+                c_stream.avail_out = buffer_size;
+                compressed_size += buffer_size;
+            }
         }
     }
 
@@ -210,22 +671,19 @@ static int zlib_compress(
             size_t new_bytes_written = c_stream.total_out - compressed_size;
             ostream.write((const char *) outbuf, new_bytes_written);
             c_stream.next_out = outbuf;
-            c_stream.avail_out = OUTPUT_BUFF_SIZE;
+            c_stream.avail_out = buffer_size;
             compressed_size += new_bytes_written;
         }
 
         if (ret == Z_STREAM_END) break;
         ret = deflate(&c_stream, Z_FINISH);
+        if (ret != Z_OK && ret != Z_STREAM_END)
+        {
+            zlib_contexts.discard_deflater();
+            CHECK_ZLIB_ERR(ret, "deflate");
+        }
     }
 
-    ret = deflateEnd(&c_stream);
-    if (ret != Z_OK)
-    {
-        free(outbuf);
-        throw std::runtime_error("zlib error: deflateEnd");
-    }
-
-    free(outbuf);
     *output_size = compressed_size;
 
     return 0;
@@ -238,26 +696,79 @@ static int zlib_decompress(
         size_t input_size)
 {
     int err;
-    z_stream stream;
 
-    stream.zalloc = Z_NULL;
-    stream.zfree = Z_NULL;
+    z_stream &stream = zlib_contexts.get_inflater();
     stream.next_in = (Bytef *) input;
     stream.avail_in = input_size;
     stream.next_out = (Bytef *) output;
     stream.avail_out = output_size;
 
-    err = inflateInit(&stream);
-    CHECK_ZLIB_ERR(err, "inflateInit");
-
     err = inflate(&stream, Z_NO_FLUSH);
     if (err != Z_STREAM_END)
     {
+        zlib_contexts.discard_inflater();
         CHECK_ZLIB_ERR(err, "inflate");
     }
 
-    err = inflateEnd(&stream);
-    CHECK_ZLIB_ERR(err, "inflateEnd");
+    return 0;
+}
+
+static int zlib_decompress_windows(
+        const uint8_t *input,
+        size_t input_size,
+        size_t output_size,
+        size_t alignment,
+        const WindowConsumer &consume)
+{
+    int err = Z_OK;
+
+    const size_t window_size = window_size_for(alignment);
+    uint8_t *window = thread_buffer(window_role, window_size);
+
+    z_stream &stream = zlib_contexts.get_inflater();
+    stream.next_in = (Bytef *) input;
+    stream.avail_in = input_size;
+
+    for (size_t offset = 0; offset < output_size; offset += window_size)
+    {
+        const size_t size = std::min(window_size, output_size - offset);
+
+        stream.next_out = (Bytef *) window;
+        stream.avail_out = size;
+
+        while (stream.avail_out > 0 && err != Z_STREAM_END)
+        {
+            err = inflate(&stream, Z_NO_FLUSH);
+            if (err != Z_STREAM_END && err != Z_OK)
+            {
+                zlib_contexts.discard_inflater();
+                CHECK_ZLIB_ERR(err, "inflate");
+            }
+        }
+
+        if (stream.avail_out > 0)
+        {
+            zlib_contexts.discard_inflater();
+            throw std::runtime_error("zlib error: unexpected decompressed size");
+        }
+
+        consume(window, offset, size);
+    }
+
+    /* The end of the stream may still follow the last of the data */
+    if (err != Z_STREAM_END)
+    {
+        uint8_t extra;
+        stream.next_out = (Bytef *) &extra;
+        stream.avail_out = 1;
+
+        err = inflate(&stream, Z_NO_FLUSH);
+        if (err != Z_STREAM_END || stream.avail_out == 0)
+        {
+            zlib_contexts.discard_inflater();
+            throw std::runtime_error("zlib error: unexpected decompressed size");
+        }
+    }
 
     return 0;
 }
@@ -268,54 +779,64 @@ static int bzip2_compress(
     std::ostream &ostream,
     size_t *output_size,
     const uint8_t *input,
-    size_t input_size)
+    size_t input_size,
+    const CompressionOptions &options,
+    const InputFilter &filter)
 {
     int ret;
     bz_stream c_stream;
 
-    /* Allocate temporary buffer for compressed data output */
-    char *outbuf = (char *) malloc(OUTPUT_BUFF_SIZE);
-    if (outbuf == nullptr)
-    {
-        std::string msg = "Failed to allocate temporary buffer for compressed output: ";
-        throw std::runtime_error(msg + strerror(errno));
-    }
+    /* bzip2 has no way to reset a stream, but the buffer can be reused */
+    const size_t buffer_size = options.buffer_size;
+    char *outbuf = (char *) thread_buffer(scratch_role, buffer_size);
 
     c_stream.bzalloc = nullptr;
     c_stream.bzfree = nullptr;
-    c_stream.next_in = (char *) input;
-    c_stream.avail_in = input_size;
+    c_stream.next_in = nullptr;
+    c_stream.avail_in = 0;
     c_stream.next_out = outbuf;
-    c_stream.avail_out = OUTPUT_BUFF_SIZE;
+    c_stream.avail_out = buffer_size;
 
-    ret = BZ2_bzCompressInit(&c_stream, 5, 0, 0);
+    const int block_size = (options.level == COMPRESSION_LEVEL_DEFAULT) ?
+        5 : options.level;
+
+    c_stream.opaque = nullptr;
+
+    ret = BZ2_bzCompressInit(&c_stream, block_size, 0, 0);
     if (ret != BZ_OK)
     {
-        free(outbuf);
         throw std::runtime_error("bzip2 error: deflateInit");
     }
 
     size_t compressed_size = 0;
-    size_t total_in = PACK_U64(c_stream.total_in_hi32, c_stream.total_in_lo32);
 
     /* Process all of the input */
-    while (total_in < input_size)
+    InputWindows windows(input, input_size, filter);
+    const uint8_t *window;
+    size_t window_size;
+
+    while (windows.next(&window, &window_size))
     {
-        ret = BZ2_bzCompress(&c_stream, BZ_RUN);
-        total_in = PACK_U64(c_stream.total_in_hi32, c_stream.total_in_lo32);
-        if (ret != BZ_RUN_OK)
-        {
-            free(outbuf);
-            CHECK_BZIP_ERR(ret, "compress");
-        }
+        c_stream.next_in = (char *) window;
+        c_stream.avail_in = window_size;
 
-        if (c_stream.avail_out == 0)
+        while (c_stream.avail_in > 0)
         {
-            ostream.write((const char *) outbuf, OUTPUT_BUFF_SIZE);
-            /* Reset to the beginning of the temporary buffer */
-            c_stream.next_out = outbuf;
-            c_stream.avail_out = OUTPUT_BUFF_SIZE;
-            compressed_size += OUTPUT_BUFF_SIZE;
+            ret = BZ2_bzCompress(&c_stream, BZ_RUN);
+            if (ret != BZ_RUN_OK)
+            {
+                BZ2_bzCompressEnd(&c_stream);
+                CHECK_BZIP_ERR(ret, "compress");
+            }
+
+            if (c_stream.avail_out == 0)
+            {
+                ostream.write((const char *) outbuf, buffer_size);
+                /* Reset to the beginning of the temporary buffer */
+                c_stream.next_out = outbuf;
+                c_stream.avail_out = buffer_size;
+                compressed_size += buffer_size;
+            }
         }
     }
 
@@ -329,7 +850,7 @@ static int bzip2_compress(
 
             ostream.write((const char *) outbuf, new_bytes_written);
             c_stream.next_out = outbuf;
-            c_stream.avail_out = OUTPUT_BUFF_SIZE;
+            c_stream.avail_out = buffer_size;
             compressed_size += new_bytes_written;
         }
 
@@ -337,7 +858,7 @@ static int bzip2_compress(
         ret = BZ2_bzCompress(&c_stream, BZ_FINISH);
     }
 
-    free(outbuf);
+    BZ2_bzCompressEnd(&c_stream);
     *output_size = compressed_size;
 
     return 0;
@@ -373,4 +894,411 @@ static int bzip2_decompress(
 
     return 0;
 }
+
+static int bzip2_decompress_windows(
+        const uint8_t *input,
+        size_t input_size,
+        size_t output_size,
+        size_t alignment,
+        const WindowConsumer &consume)
+{
+    int ret;
+    bz_stream stream;
+
+    const size_t window_size = window_size_for(alignment);
+    uint8_t *window = thread_buffer(window_role, window_size);
+
+    stream.bzalloc = nullptr;
+    stream.bzfree = nullptr;
+    stream.next_in = (char *) input;
+    stream.avail_in = input_size;
+
+    ret = BZ2_bzDecompressInit(&stream, 0, 0);
+    CHECK_BZIP_ERR(ret, "bzDecompressInit");
+
+    try
+    {
+        for (size_t offset = 0; offset < output_size; offset += window_size)
+        {
+            const size_t size = std::min(window_size, output_size - offset);
+
+            stream.next_out = (char *) window;
+            stream.avail_out = size;
+
+            while (stream.avail_out > 0 && ret != BZ_STREAM_END)
+            {
+                ret = BZ2_bzDecompress(&stream);
+                if (ret != BZ_STREAM_END)
+                {
+                    CHECK_BZIP_ERR(ret, "bzDecompress");
+                }
+
+                /* Without more input, no more data will come out */
+                if (ret == BZ_OK && stream.avail_in == 0 && stream.avail_out > 0)
+                {
+                    break;
+                }
+            }
+
+            if (stream.avail_out > 0)
+            {
+                throw std::runtime_error(
+                    "bzip error: unexpected decompressed size");
+            }
+
+            consume(window, offset, size);
+        }
+
+        if (ret != BZ_STREAM_END)
+        {
+            char extra;
+            stream.next_out = &extra;
+            stream.avail_out = 1;
+
+            ret = BZ2_bzDecompress(&stream);
+            if (ret != BZ_STREAM_END || stream.avail_out == 0)
+            {
+                throw std::runtime_error(
+                    "bzip error: unexpected decompressed size");
+            }
+        }
+    }
+    catch (...)
+    {
+        BZ2_bzDecompressEnd(&stream);
+        throw;
+    }
+
+    ret = BZ2_bzDecompressEnd(&stream);
+    CHECK_BZIP_ERR(ret, "bzDecompressEnd");
+
+    return 0;
+}
+#endif
+
+#ifdef HAS_ZSTD
+static int zstd_compress(
+    std::ostream &ostream,
+    size_t *output_size,
+    const uint8_t *input,
+    size_t input_size,
+    const CompressionOptions &options,
+    const InputFilter &filter)
+{
+    ZSTD_CCtx *cctx = zstd_contexts.get_cctx();
+
+    const size_t buffer_size = options.buffer_size;
+    char *outbuf = (char *) thread_buffer(scratch_role, buffer_size);
+
+    /* Levels and strategies that zstd doesn't accept are reported here */
+    if (options.level != COMPRESSION_LEVEL_DEFAULT)
+    {
+        CHECK_ZSTD_ERR(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                              options.level));
+    }
+
+    if (options.strategy != 0)
+    {
+        CHECK_ZSTD_ERR(ZSTD_CCtx_setParameter(cctx, ZSTD_c_strategy,
+                                              options.strategy));
+    }
+
+    /* This records the uncompressed size in the frame header */
+    CHECK_ZSTD_ERR(ZSTD_CCtx_setPledgedSrcSize(cctx, input_size));
+
+    size_t compressed_size = 0;
+    size_t remaining;
+
+    InputWindows windows(input, input_size, filter);
+    const uint8_t *window;
+    size_t window_size;
+
+    while (windows.next(&window, &window_size))
+    {
+        ZSTD_inBuffer in_buffer = { window, window_size, 0 };
+
+        while (in_buffer.pos < in_buffer.size)
+        {
+            ZSTD_outBuffer out_buffer = { outbuf, buffer_size, 0 };
+
+            remaining = ZSTD_compressStream2(cctx, &out_buffer, &in_buffer,
+                                             ZSTD_e_continue);
+            CHECK_ZSTD_ERR(remaining);
+
+            ostream.write((const char *) outbuf, out_buffer.pos);
+            compressed_size += out_buffer.pos;
+        }
+    }
+
+    /* Flush whatever is left and finish the frame */
+    ZSTD_inBuffer in_buffer = { nullptr, 0, 0 };
+
+    do
+    {
+        ZSTD_outBuffer out_buffer = { outbuf, buffer_size, 0 };
+
+        remaining = ZSTD_compressStream2(cctx, &out_buffer, &in_buffer,
+                                         ZSTD_e_end);
+        CHECK_ZSTD_ERR(remaining);
+
+        ostream.write((const char *) outbuf, out_buffer.pos);
+        compressed_size += out_buffer.pos;
+    } while (remaining != 0);
+
+    *output_size = compressed_size;
+
+    return 0;
+}
+
+static int zstd_decompress(
+        uint8_t *output,
+        size_t output_size,
+        const uint8_t *input,
+        size_t input_size)
+{
+    /* This also handles data that consists of several frames */
+    size_t ret = ZSTD_decompressDCtx(zstd_contexts.get_dctx(), output,
+                                     output_size, input, input_size);
+    CHECK_ZSTD_ERR(ret);
+
+    if (ret != output_size)
+    {
+        throw std::runtime_error("zstd error: unexpected decompressed size");
+    }
+
+    return 0;
+}
+
+static int zstd_decompress_windows(
+        const uint8_t *input,
+        size_t input_size,
+        size_t output_size,
+        size_t alignment,
+        const WindowConsumer &consume)
+{
+    const size_t window_size = window_size_for(alignment);
+    uint8_t *window = thread_buffer(window_role, window_size);
+
+    ZSTD_DCtx *dctx = zstd_contexts.get_dctx();
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+
+    ZSTD_inBuffer in = { input, input_size, 0 };
+    size_t ret = 0;
+
+    for (size_t offset = 0; offset < output_size; offset += window_size)
+    {
+        const size_t size = std::min(window_size, output_size - offset);
+        ZSTD_outBuffer out = { window, size, 0 };
+
+        while (out.pos < out.size)
+        {
+            if (in.pos == in.size)
+            {
+                throw std::runtime_error(
+                    "zstd error: unexpected decompressed size");
+            }
+
+            ret = ZSTD_decompressStream(dctx, &out, &in);
+            CHECK_ZSTD_ERR(ret);
+        }
+
+        consume(window, offset, size);
+    }
+
+    /* Anything left over means the data is larger than expected */
+    if (ret != 0 || in.pos != in.size)
+    {
+        throw std::runtime_error("zstd error: unexpected decompressed size");
+    }
+
+    return 0;
+}
+#endif
+
+#ifdef HAS_LZ4
+static int lz4_compress(
+    std::ostream &ostream,
+    size_t *output_size,
+    const uint8_t *input,
+    size_t input_size,
+    const CompressionOptions &options,
+    const InputFilter &filter)
+{
+    /* Room for the two size prefixes followed by a compressed chunk */
+    const size_t bound = LZ4_compressBound(ASDF_LZ4_CHUNK_SIZE) + 8;
+
+    uint8_t *outbuf = thread_buffer(scratch_role, bound);
+
+    /* The compression state is kept around rather than set up every time */
+    thread_local std::vector<uint64_t> state(
+            (LZ4_sizeofState() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+
+    const int acceleration = (options.level == COMPRESSION_LEVEL_DEFAULT) ?
+        1 : options.level;
+    size_t compressed_size = 0;
+
+    /* Each chunk is a window of the input */
+    InputWindows windows(input, input_size, filter, ASDF_LZ4_CHUNK_SIZE);
+    const uint8_t *window;
+    size_t window_size;
+
+    while (windows.next(&window, &window_size))
+    {
+        const uint32_t count = window_size;
+
+        int ret = LZ4_compress_fast_extState(state.data(),
+                                             (const char *) window,
+                                             (char *) outbuf + 8, count,
+                                             bound - 8, acceleration);
+        if (ret <= 0)
+        {
+            throw std::runtime_error("lz4 error: compress");
+        }
+
+        /* The length of the chunk includes its uncompressed size */
+        const uint32_t length = ret + 4;
+        for (int i = 0; i < 4; i++)
+        {
+            outbuf[i] = (length >> (8 * (3 - i))) & 0xff;
+            outbuf[4 + i] = (count >> (8 * i)) & 0xff;
+        }
+
+        ostream.write((const char *) outbuf, ret + 8);
+        compressed_size += ret + 8;
+    }
+
+    *output_size = compressed_size;
+
+    return 0;
+}
+
+static int lz4_decompress(
+        uint8_t *output,
+        size_t output_size,
+        const uint8_t *input,
+        size_t input_size)
+{
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+
+    while (in_pos < input_size)
+    {
+        if (input_size - in_pos < 8)
+        {
+            throw std::runtime_error("lz4 error: truncated chunk header");
+        }
+
+        const uint8_t *chunk = input + in_pos;
+        uint32_t length = 0;
+        uint32_t count = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            length = (length << 8) | chunk[i];
+            count |= (uint32_t) chunk[4 + i] << (8 * i);
+        }
+
+        if (length < 4 || length > input_size - in_pos - 4 ||
+            count > output_size - out_pos)
+        {
+            throw std::runtime_error("lz4 error: invalid chunk header");
+        }
+
+        int ret = LZ4_decompress_safe((const char *) chunk + 8,
+                                      (char *) output + out_pos,
+                                      length - 4, count);
+        if (ret < 0 || (uint32_t) ret != count)
+        {
+            throw std::runtime_error("lz4 error: decompress");
+        }
+
+        in_pos += 4 + length;
+        out_pos += count;
+    }
+
+    if (out_pos != output_size)
+    {
+        throw std::runtime_error("lz4 error: unexpected decompressed size");
+    }
+
+    return 0;
+}
+
+/*
+ * Each lz4 chunk is decompressed in one go, so here the windows are chunks.
+ * Bytes that don't make up a whole multiple of alignment are carried over to
+ * the next window.
+ */
+static int lz4_decompress_windows(
+        const uint8_t *input,
+        size_t input_size,
+        size_t output_size,
+        size_t alignment,
+        const WindowConsumer &consume)
+{
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+    size_t carry = 0;
+
+    alignment = std::max(alignment, (size_t) 1);
+
+    while (in_pos < input_size)
+    {
+        if (input_size - in_pos < 8)
+        {
+            throw std::runtime_error("lz4 error: truncated chunk header");
+        }
+
+        const uint8_t *chunk = input + in_pos;
+        uint32_t length = 0;
+        uint32_t count = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            length = (length << 8) | chunk[i];
+            count |= (uint32_t) chunk[4 + i] << (8 * i);
+        }
+
+        if (length < 4 || length > input_size - in_pos - 4 ||
+            count > output_size - out_pos - carry)
+        {
+            throw std::runtime_error("lz4 error: invalid chunk header");
+        }
+
+        /* The carried bytes stay at the start of the buffer */
+        uint8_t *window = thread_buffer(window_role, carry + count);
+
+        int ret = LZ4_decompress_safe((const char *) chunk + 8,
+                                      (char *) window + carry,
+                                      length - 4, count);
+        if (ret < 0 || (uint32_t) ret != count)
+        {
+            throw std::runtime_error("lz4 error: decompress");
+        }
+
+        const size_t available = carry + count;
+        const size_t size = available - available % alignment;
+        if (size > 0)
+        {
+            consume(window, out_pos, size);
+        }
+
+        carry = available - size;
+        memmove(window, window + size, carry);
+
+        in_pos += 4 + length;
+        out_pos += size;
+    }
+
+    if (carry > 0)
+    {
+        consume(thread_buffer(window_role, carry), out_pos, carry);
+        out_pos += carry;
+    }
+
+    if (out_pos != output_size)
+    {
+        throw std::runtime_error("lz4 error: unexpected decompressed size");
+    }
+
+    return 0;
+}
 #endif
@@ -0,0 +1,422 @@
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include <asdf-cpp/convert.hpp>
+#include <asdf-cpp/byteswap.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ASDF_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Byteswapped elements are staged in a buffer of this size on the stack, small
+ * enough to stay in the L1 cache while they are converted.
+ */
+#define CONVERT_TILE_BYTES  (1ul << 14)
+
+
+namespace Asdf {
+
+namespace {
+
+typedef void (*scalar_kernel_t)(void *, const uint8_t *, size_t);
+
+/* Each SIMD kernel returns the number of elements it handled, from the start */
+typedef size_t (*simd_kernel_t)(void *, const uint8_t *, size_t);
+
+template <typename S, typename D>
+inline D convert_value(S value, std::false_type)
+{
+    return (D) value;
+}
+
+/*
+ * Casting a floating point value that doesn't fit into an integer type is
+ * undefined, so these saturate instead and NaN becomes zero
+ */
+template <typename S, typename D>
+inline D convert_value(S value, std::true_type)
+{
+    const D lowest = std::numeric_limits<D>::min();
+    const D highest = std::numeric_limits<D>::max();
+
+    if (value != value)
+    {
+        return 0;
+    }
+    else if (value <= (S) lowest)
+    {
+        return lowest;
+    }
+    /* The highest value may round up to the next power of two */
+    else if (value >= (S) highest)
+    {
+        return highest;
+    }
+
+    return (D) value;
+}
+
+template <typename S, typename D>
+void convert_scalar(void *dst, const uint8_t *src, size_t count)
+{
+    typedef std::integral_constant<bool,
+        std::is_floating_point<S>::value and std::is_integral<D>::value and
+        not std::is_same<D, bool>::value> saturate;
+
+    D *out = (D *) dst;
+
+    /* memcpy keeps this safe for unaligned windows */
+    for (size_t i = 0; i < count; i++)
+    {
+        S value;
+        memcpy(&value, src + i * sizeof(S), sizeof(S));
+        out[i] = convert_value<S, D>(value, saturate());
+    }
+}
+
+template <typename D>
+scalar_kernel_t scalar_kernel_to(DType src_type)
+{
+    switch (src_type)
+    {
+        case int8_dtype:
+            return convert_scalar<int8_t, D>;
+        case int16_dtype:
+            return convert_scalar<int16_t, D>;
+        case int32_dtype:
+            return convert_scalar<int32_t, D>;
+        case int64_dtype:
+            return convert_scalar<int64_t, D>;
+        /* Stored booleans may hold any nonzero byte, so read them as such */
+        case uint8_dtype:
+        case bool8_dtype:
+            return convert_scalar<uint8_t, D>;
+        case uint16_dtype:
+            return convert_scalar<uint16_t, D>;
+        case uint32_dtype:
+            return convert_scalar<uint32_t, D>;
+        case uint64_dtype:
+            return convert_scalar<uint64_t, D>;
+        case float32_dtype:
+            return convert_scalar<float, D>;
+        case float64_dtype:
+            return convert_scalar<double, D>;
+        default:
+            break;
+    }
+
+    return nullptr;
+}
+
+scalar_kernel_t scalar_kernel(DType dst_type, DType src_type)
+{
+    switch (dst_type)
+    {
+        case int8_dtype:
+            return scalar_kernel_to<int8_t>(src_type);
+        case int16_dtype:
+            return scalar_kernel_to<int16_t>(src_type);
+        case int32_dtype:
+            return scalar_kernel_to<int32_t>(src_type);
+        case int64_dtype:
+            return scalar_kernel_to<int64_t>(src_type);
+        case uint8_dtype:
+            return scalar_kernel_to<uint8_t>(src_type);
+        case uint16_dtype:
+            return scalar_kernel_to<uint16_t>(src_type);
+        case uint32_dtype:
+            return scalar_kernel_to<uint32_t>(src_type);
+        case uint64_dtype:
+            return scalar_kernel_to<uint64_t>(src_type);
+        case float32_dtype:
+            return scalar_kernel_to<float>(src_type);
+        case float64_dtype:
+            return scalar_kernel_to<double>(src_type);
+        case bool8_dtype:
+            return scalar_kernel_to<bool>(src_type);
+        default:
+            break;
+    }
+
+    return nullptr;
+}
+
+#ifdef ASDF_X86_SIMD
+
+__attribute__((target("avx2")))
+size_t int8_to_float32_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    float *out = (float *) dst;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadl_epi64((const __m128i *)(src + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v)));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t uint8_to_float32_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    float *out = (float *) dst;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadl_epi64((const __m128i *)(src + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t int16_to_float32_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    float *out = (float *) dst;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t uint16_to_float32_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    float *out = (float *) dst;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t int32_to_float32_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    float *out = (float *) dst;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(v));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t int16_to_float64_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    double *out = (double *) dst;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadl_epi64((const __m128i *)(src + 2 * i));
+        _mm256_storeu_pd(out + i, _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(v)));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t int32_to_float64_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    double *out = (double *) dst;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        _mm256_storeu_pd(out + i, _mm256_cvtepi32_pd(v));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t float32_to_float64_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    double *out = (double *) dst;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 v = _mm_loadu_ps((const float *)(src + 4 * i));
+        _mm256_storeu_pd(out + i, _mm256_cvtps_pd(v));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t float64_to_float32_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    float *out = (float *) dst;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d v = _mm256_loadu_pd((const double *)(src + 8 * i));
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(v));
+    }
+
+    return i;
+}
+
+/* Any single byte type becomes 1 where it is nonzero and 0 elsewhere */
+__attribute__((target("avx2")))
+size_t byte_to_bool8_avx2(void *dst, const uint8_t *src, size_t count)
+{
+    uint8_t *out = (uint8_t *) dst;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i is_zero = _mm256_cmpeq_epi8(v, zero);
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_andnot_si256(is_zero, one));
+    }
+
+    return i;
+}
+
+struct SimdConversion
+{
+    DType dst_type;
+    DType src_type;
+    simd_kernel_t kernel;
+};
+
+const SimdConversion simd_conversions[] = {
+    { float32_dtype, int8_dtype,    int8_to_float32_avx2 },
+    { float32_dtype, uint8_dtype,   uint8_to_float32_avx2 },
+    { float32_dtype, int16_dtype,   int16_to_float32_avx2 },
+    { float32_dtype, uint16_dtype,  uint16_to_float32_avx2 },
+    { float32_dtype, int32_dtype,   int32_to_float32_avx2 },
+    { float32_dtype, float64_dtype, float64_to_float32_avx2 },
+    { float64_dtype, int16_dtype,   int16_to_float64_avx2 },
+    { float64_dtype, int32_dtype,   int32_to_float64_avx2 },
+    { float64_dtype, float32_dtype, float32_to_float64_avx2 },
+    { bool8_dtype,   int8_dtype,    byte_to_bool8_avx2 },
+    { bool8_dtype,   uint8_dtype,   byte_to_bool8_avx2 },
+    { bool8_dtype,   bool8_dtype,   byte_to_bool8_avx2 },
+};
+
+simd_kernel_t simd_kernel(DType dst_type, DType src_type)
+{
+    static const bool avx2 = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+
+    if (not avx2)
+    {
+        return nullptr;
+    }
+
+    for (auto &conversion : simd_conversions)
+    {
+        if (conversion.dst_type == dst_type && conversion.src_type == src_type)
+        {
+            return conversion.kernel;
+        }
+    }
+
+    return nullptr;
+}
+
+#else
+
+simd_kernel_t simd_kernel(DType, DType)
+{
+    return nullptr;
+}
+
+#endif /* ASDF_X86_SIMD */
+
+} /* namespace */
+
+void convert_data(void *dst, DType dst_type, const void *src, DType src_type,
+                  size_t count, bool swap)
+{
+    const size_t src_size = DType_size(src_type);
+    const size_t dst_size = DType_size(dst_type);
+
+    if (src_size == 0 || dst_size == 0)
+    {
+        throw std::runtime_error(
+            "Can't convert from " + DType_to_string(src_type) + " to " +
+            DType_to_string(dst_type));
+    }
+
+    swap = swap && src_size > 1;
+
+    /* Booleans still need to be normalized to 0 or 1 */
+    if (dst_type == src_type && dst_type != bool8_dtype)
+    {
+        if (swap)
+        {
+            byteswap_copy(dst, src, count, src_size);
+        }
+        else if (dst != src)
+        {
+            memcpy(dst, src, count * src_size);
+        }
+
+        return;
+    }
+
+    const simd_kernel_t simd = simd_kernel(dst_type, src_type);
+    const scalar_kernel_t scalar = scalar_kernel(dst_type, src_type);
+
+    uint8_t *out = (uint8_t *) dst;
+    const uint8_t *in = (const uint8_t *) src;
+
+    auto convert = [&](uint8_t *out, const uint8_t *in, size_t count)
+    {
+        size_t done = (simd != nullptr) ? simd(out, in, count) : 0;
+        scalar(out + done * dst_size, in + done * src_size, count - done);
+    };
+
+    if (not swap)
+    {
+        convert(out, in, count);
+        return;
+    }
+
+    alignas(64) uint8_t tile[CONVERT_TILE_BYTES];
+    const size_t tile_count = CONVERT_TILE_BYTES / src_size;
+
+    for (size_t start = 0; start < count; start += tile_count)
+    {
+        const size_t length = std::min(tile_count, count - start);
+
+        byteswap_copy(tile, in + start * src_size, length, src_size);
+        convert(out + start * dst_size, tile, length);
+    }
+}
+
+} /* namespace Asdf */
@@ -0,0 +1,119 @@
+#include <string>
+#include <stdexcept>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <asdf-cpp/file_data.hpp>
+
+
+namespace Asdf {
+
+FileData::FileData(std::string filename, AccessMode mode)
+{
+    struct stat sb;
+
+    writable = (mode == read_write);
+
+    fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+    {
+        std::string msg("Error opening " + filename + ": ");
+        throw std::runtime_error(msg + strerror(errno));
+    }
+
+    fstat(fd, &sb);
+    size = sb.st_size;
+
+    const int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    data = (uint8_t *) mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        std::string msg("Error memory mapping file: ");
+        throw std::runtime_error(msg + strerror(errno));
+    }
+
+    memmapped = true;
+}
+
+FileData::FileData(std::iostream &stream)
+{
+    stream.seekp(0, std::ios::end);
+    size = stream.tellp();
+
+    std::basic_streambuf<char> *sbuf = stream.rdbuf();
+    data = (uint8_t *) malloc(size);
+    if (data == nullptr)
+    {
+        std::string msg("Error creating buffer for file data: ");
+        throw std::runtime_error(msg + strerror(errno));
+    }
+
+    sbuf->pubseekpos(0, std::ios::in);
+    sbuf->sgetn((char *) data, size);
+}
+
+FileData::~FileData()
+{
+    if (memmapped)
+    {
+        munmap(data, size);
+        close(fd);
+    }
+    else
+    {
+        free(data);
+    }
+}
+
+void FileData::sync(size_t offset, size_t length) const
+{
+    if (not writable)
+    {
+        return;
+    }
+
+    /* The address passed to msync must be aligned to a page boundary */
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t aligned = offset - (offset % page_size);
+
+    if (msync(data + aligned, length + (offset - aligned), MS_SYNC) != 0)
+    {
+        std::string msg("Error syncing memory map to file: ");
+        throw std::runtime_error(msg + strerror(errno));
+    }
+}
+
+std::shared_ptr<uint8_t> FileData::map_private(size_t offset, size_t length) const
+{
+    if (not memmapped)
+    {
+        return nullptr;
+    }
+
+    /* The offset of a mapping must be aligned to a page boundary */
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t aligned = offset - (offset % page_size);
+    const size_t map_length = length + (offset - aligned);
+
+    uint8_t *base = (uint8_t *) mmap(NULL, map_length, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE, fd, aligned);
+    if (base == MAP_FAILED)
+    {
+        std::string msg("Error creating private memory map: ");
+        throw std::runtime_error(msg + strerror(errno));
+    }
+
+    return std::shared_ptr<uint8_t>(base + (offset - aligned),
+            [base, map_length](uint8_t *) { munmap(base, map_length); });
+}
+
+} /* namespace Asdf */
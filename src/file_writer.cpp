@@ -0,0 +1,327 @@
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <asdf-cpp/file_writer.hpp>
+
+
+static void throw_error(std::string msg)
+{
+    throw std::runtime_error(msg + ": " + strerror(errno));
+}
+
+/* Writes all of the given buffers, resuming after partial writes */
+static void write_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw_error("Error writing file");
+        }
+
+        while (count > 0 && (size_t) written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+
+namespace Asdf {
+
+FileWriter::FileWriter(std::string filename, bool direct_io)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+#ifdef O_DIRECT
+    if (direct_io)
+    {
+        fd = open(filename.c_str(), flags | O_DIRECT, 0666);
+
+        /* The file system doesn't support direct I/O */
+        direct = fd >= 0;
+        if (fd < 0 && errno != EINVAL)
+        {
+            throw_error("Error opening " + filename);
+        }
+    }
+#endif
+
+    if (fd < 0)
+    {
+        fd = open(filename.c_str(), flags, 0666);
+        if (fd < 0)
+        {
+            throw_error("Error opening " + filename);
+        }
+    }
+
+    if (direct)
+    {
+        if (posix_memalign((void **) &staging, DIRECT_IO_ALIGNMENT,
+                           DIRECT_IO_BUFFER_SIZE) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Unable to allocate staging buffer");
+        }
+    }
+    else
+    {
+        pending.reserve(FILE_WRITER_GATHER_SIZE);
+    }
+}
+
+FileWriter::~FileWriter()
+{
+    if (fd >= 0)
+    {
+        try
+        {
+            close();
+        }
+        catch (...)
+        {
+            /* Errors can only be reported by calling close explicitly */
+        }
+    }
+
+    free(staging);
+}
+
+void FileWriter::reserve(size_t size)
+{
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    /* This is only a hint, so file systems that can't do it are fine */
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0)
+    {
+        reserved = true;
+    }
+#else
+    (void) size;
+#endif
+}
+
+void FileWriter::close()
+{
+    if (fd < 0)
+    {
+        return;
+    }
+
+    try
+    {
+        if (direct)
+        {
+            /* The last write must also be aligned, so pad it out */
+            if (staged > 0)
+            {
+                const size_t size = staged + (DIRECT_IO_ALIGNMENT -
+                        staged % DIRECT_IO_ALIGNMENT) % DIRECT_IO_ALIGNMENT;
+                memset(staging + staged, 0, size - staged);
+                write_staging(size);
+            }
+        }
+        else
+        {
+            flush_pending();
+        }
+
+        /*
+         * Cut off the padding of the last direct write, and release any
+         * reserved space that wasn't used. File systems keep blocks that
+         * were allocated past the end of the file until it is truncated.
+         */
+        if (direct or reserved)
+        {
+            if (ftruncate(fd, length) != 0)
+            {
+                throw_error("Error truncating file");
+            }
+        }
+    }
+    catch (...)
+    {
+        ::close(fd);
+        fd = -1;
+        throw;
+    }
+
+    const int result = ::close(fd);
+    fd = -1;
+
+    if (result != 0)
+    {
+        throw_error("Error closing file");
+    }
+}
+
+std::streamsize FileWriter::xsputn(const char *s, std::streamsize n)
+{
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    if (direct)
+    {
+        stage(s, n);
+    }
+    else if ((size_t) n < FILE_WRITER_GATHER_SIZE)
+    {
+        pending.insert(pending.end(), s, s + n);
+        if (pending.size() >= FILE_WRITER_GATHER_SIZE)
+        {
+            flush_pending();
+        }
+    }
+    else
+    {
+        flush_pending(s, n);
+    }
+
+    position += n;
+    length = std::max(length, position);
+    return n;
+}
+
+FileWriter::int_type FileWriter::overflow(int_type c)
+{
+    if (c != traits_type::eof())
+    {
+        char ch = (char) c;
+        if (xsputn(&ch, 1) != 1)
+        {
+            return traits_type::eof();
+        }
+    }
+
+    return traits_type::not_eof(c);
+}
+
+int FileWriter::sync()
+{
+    /* Partial blocks can't be written with direct I/O until the end */
+    if (not direct && fd >= 0)
+    {
+        flush_pending();
+    }
+
+    return 0;
+}
+
+FileWriter::pos_type FileWriter::seekoff(off_type off,
+        std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+    if (dir == std::ios_base::cur)
+    {
+        return seekpos(position + off, which);
+    }
+    else if (dir == std::ios_base::beg)
+    {
+        return seekpos(off, which);
+    }
+
+    return pos_type(off_type(-1));
+}
+
+FileWriter::pos_type FileWriter::seekpos(pos_type pos,
+        std::ios_base::openmode which)
+{
+    /* Direct output is strictly sequential, so report it as unseekable */
+    if (direct || fd < 0 || not (which & std::ios_base::out))
+    {
+        return pos_type(off_type(-1));
+    }
+
+    if ((size_t) pos == position)
+    {
+        return pos;
+    }
+
+    flush_pending();
+    if (lseek(fd, pos, SEEK_SET) < 0)
+    {
+        return pos_type(off_type(-1));
+    }
+
+    position = pos;
+    return pos;
+}
+
+/* Writes the held back data, gathered with the given buffer if there is one */
+void FileWriter::flush_pending(const char *extra, size_t extra_size)
+{
+    struct iovec iov[2];
+    int count = 0;
+
+    if (not pending.empty())
+    {
+        iov[count].iov_base = pending.data();
+        iov[count].iov_len = pending.size();
+        count++;
+    }
+
+    if (extra_size > 0)
+    {
+        iov[count].iov_base = (void *) extra;
+        iov[count].iov_len = extra_size;
+        count++;
+    }
+
+    write_all(fd, iov, count);
+    pending.clear();
+}
+
+void FileWriter::stage(const char *s, size_t n)
+{
+    while (n > 0)
+    {
+        const size_t count = std::min(n, DIRECT_IO_BUFFER_SIZE - staged);
+        memcpy(staging + staged, s, count);
+
+        staged += count;
+        s += count;
+        n -= count;
+
+        if (staged == DIRECT_IO_BUFFER_SIZE)
+        {
+            write_staging(staged);
+        }
+    }
+}
+
+void FileWriter::write_staging(size_t size)
+{
+    struct iovec iov;
+    iov.iov_base = staging;
+    iov.iov_len = size;
+
+    write_all(fd, &iov, 1);
+    staged = 0;
+}
+
+} /* namespace Asdf */
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+
+#include <asdf-cpp/hyperslab.hpp>
+
+
+namespace Asdf {
+
+static size_t flat_offset(
+        const std::vector<size_t> &shape,
+        const std::vector<size_t> &index)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < shape.size(); i++)
+    {
+        offset = offset * shape[i] + index[i];
+    }
+
+    return offset;
+}
+
+void copy_hyperslab(
+        uint8_t *dst,
+        const std::vector<size_t> &dst_shape,
+        const std::vector<size_t> &dst_start,
+        const uint8_t *src,
+        const std::vector<size_t> &src_shape,
+        const std::vector<size_t> &src_start,
+        const std::vector<size_t> &count,
+        size_t element_size)
+{
+    const size_t ndim = count.size();
+
+    if (ndim == 0)
+    {
+        memcpy(dst, src, element_size);
+        return;
+    }
+
+    for (auto n : count)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+    }
+
+    /* The innermost dimension is contiguous in both arrays */
+    const size_t row_size = count[ndim - 1] * element_size;
+
+    std::vector<size_t> position(ndim, 0);
+    std::vector<size_t> dst_index(dst_start);
+    std::vector<size_t> src_index(src_start);
+
+    for (;;)
+    {
+        for (size_t i = 0; i < ndim; i++)
+        {
+            dst_index[i] = dst_start[i] + position[i];
+            src_index[i] = src_start[i] + position[i];
+        }
+
+        memcpy(dst + flat_offset(dst_shape, dst_index) * element_size,
+               src + flat_offset(src_shape, src_index) * element_size,
+               row_size);
+
+        /* Advance to the next row, carrying into the outer dimensions */
+        size_t dim = ndim - 1;
+        while (dim > 0)
+        {
+            dim--;
+            if (++position[dim] < count[dim])
+            {
+                break;
+            }
+
+            position[dim] = 0;
+            if (dim == 0)
+            {
+                return;
+            }
+        }
+
+        if (ndim == 1)
+        {
+            return;
+        }
+    }
+}
+
+void copy_strided(
+        uint8_t *dst,
+        const uint8_t *src,
+        const std::vector<size_t> &shape,
+        const std::vector<ptrdiff_t> &strides,
+        size_t element_size)
+{
+    const size_t ndim = shape.size();
+
+    if (ndim == 0)
+    {
+        memcpy(dst, src, element_size);
+        return;
+    }
+
+    for (auto n : shape)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+    }
+
+    const size_t row_length = shape[ndim - 1];
+    const ptrdiff_t step = strides[ndim - 1];
+    const bool packed = step == (ptrdiff_t) element_size;
+
+    std::vector<size_t> position(ndim, 0);
+    const uint8_t *row = src;
+
+    for (;;)
+    {
+        if (packed)
+        {
+            memcpy(dst, row, row_length * element_size);
+            dst += row_length * element_size;
+        }
+        else
+        {
+            for (size_t i = 0; i < row_length; i++)
+            {
+                memcpy(dst, row + (ptrdiff_t) i * step, element_size);
+                dst += element_size;
+            }
+        }
+
+        /* Advance to the next row, carrying into the outer dimensions */
+        size_t dim = ndim - 1;
+        for (;;)
+        {
+            if (dim == 0)
+            {
+                return;
+            }
+
+            dim--;
+            row += strides[dim];
+            if (++position[dim] < shape[dim])
+            {
+                break;
+            }
+
+            row -= (ptrdiff_t) shape[dim] * strides[dim];
+            position[dim] = 0;
+        }
+    }
+}
+
+ChunkGrid::ChunkGrid(std::vector<size_t> shape, std::vector<size_t> chunk_shape)
+{
+    if (shape.size() != chunk_shape.size())
+    {
+        throw std::runtime_error(
+            "Chunk shape must have the same number of dimensions as the array");
+    }
+
+    for (size_t i = 0; i < shape.size(); i++)
+    {
+        if (chunk_shape[i] == 0)
+        {
+            throw std::runtime_error("Chunk dimensions must be non-zero");
+        }
+
+        grid_shape.push_back((shape[i] + chunk_shape[i] - 1) / chunk_shape[i]);
+    }
+
+    this->shape = shape;
+    this->chunk_shape = chunk_shape;
+}
+
+size_t ChunkGrid::get_num_chunks() const
+{
+    size_t num_chunks = 1;
+    for (auto n : grid_shape)
+    {
+        num_chunks *= n;
+    }
+
+    return num_chunks;
+}
+
+std::vector<size_t> ChunkGrid::chunk_origin(size_t index) const
+{
+    std::vector<size_t> origin(shape.size());
+
+    for (size_t i = shape.size(); i > 0; i--)
+    {
+        origin[i - 1] = (index % grid_shape[i - 1]) * chunk_shape[i - 1];
+        index /= grid_shape[i - 1];
+    }
+
+    return origin;
+}
+
+std::vector<size_t> ChunkGrid::chunk_extent(size_t index) const
+{
+    std::vector<size_t> extent = chunk_origin(index);
+
+    for (size_t i = 0; i < shape.size(); i++)
+    {
+        extent[i] = std::min(chunk_shape[i], shape[i] - extent[i]);
+    }
+
+    return extent;
+}
+
+std::vector<size_t> ChunkGrid::find_chunks(
+        const std::vector<size_t> &start,
+        const std::vector<size_t> &count) const
+{
+    const size_t ndim = shape.size();
+    std::vector<size_t> chunks;
+
+    if (start.size() != ndim || count.size() != ndim)
+    {
+        throw std::runtime_error(
+            "Region must have the same number of dimensions as the array");
+    }
+
+    std::vector<size_t> first(ndim), last(ndim);
+    for (size_t i = 0; i < ndim; i++)
+    {
+        if (count[i] == 0)
+        {
+            return chunks;
+        }
+
+        if (start[i] + count[i] > shape[i])
+        {
+            throw std::runtime_error("Region exceeds the bounds of the array");
+        }
+
+        first[i] = start[i] / chunk_shape[i];
+        last[i] = (start[i] + count[i] - 1) / chunk_shape[i];
+    }
+
+    std::vector<size_t> position(first);
+    for (;;)
+    {
+        chunks.push_back(flat_offset(grid_shape, position));
+
+        size_t dim = ndim;
+        while (dim > 0)
+        {
+            dim--;
+            if (++position[dim] <= last[dim])
+            {
+                break;
+            }
+
+            position[dim] = first[dim];
+            if (dim == 0)
+            {
+                return chunks;
+            }
+        }
+
+        if (ndim == 0)
+        {
+            return chunks;
+        }
+    }
+}
+
+} /* namespace Asdf */
@@ -0,0 +1,378 @@
+#include <cmath>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <locale>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include <asdf-cpp/inline_data.hpp>
+
+
+namespace Asdf {
+
+namespace {
+
+template <typename T> T load_value(const uint8_t *data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+/* Stored booleans may hold any nonzero byte */
+template <> bool load_value<bool>(const uint8_t *data)
+{
+    return *data != 0;
+}
+
+template <typename T> std::string format_value(T value)
+{
+    return std::to_string(value);
+}
+
+std::string format_float(double value, int digits)
+{
+    if (std::isnan(value))
+    {
+        return ".nan";
+    }
+    else if (std::isinf(value))
+    {
+        return value > 0 ? ".inf" : "-.inf";
+    }
+
+    /* YAML always uses a decimal point, whatever the locale says */
+    std::ostringstream text;
+    text.imbue(std::locale::classic());
+    text.precision(digits);
+    text << value;
+
+    return text.str();
+}
+
+template <> std::string format_value<float>(float value)
+{
+    return format_float(value, std::numeric_limits<float>::max_digits10);
+}
+
+template <> std::string format_value<double>(double value)
+{
+    return format_float(value, std::numeric_limits<double>::max_digits10);
+}
+
+template <> std::string format_value<bool>(bool value)
+{
+    return value ? "true" : "false";
+}
+
+template <typename T>
+YAML::Node encode_level(const uint8_t *&data, const std::vector<size_t> &shape,
+                        size_t dim)
+{
+    if (dim == shape.size())
+    {
+        YAML::Node scalar(format_value(load_value<T>(data)));
+        data += sizeof(T);
+        return scalar;
+    }
+
+    YAML::Node node(YAML::NodeType::Sequence);
+    node.SetStyle(YAML::EmitterStyle::Flow);
+
+    for (size_t i = 0; i < shape[dim]; i++)
+    {
+        node.push_back(encode_level<T>(data, shape, dim + 1));
+    }
+
+    return node;
+}
+
+/*
+ * Each of these returns false if the text is not a plain decimal number that
+ * fits the type, in which case yaml-cpp gets to try instead.
+ */
+template <typename T>
+typename std::enable_if<std::is_signed<T>::value and
+                        std::is_integral<T>::value, bool>::type
+parse_text(const char *text, T &value)
+{
+    char *end;
+    errno = 0;
+    long long result = strtoll(text, &end, 10);
+
+    if (end == text or *end != '\0' or errno != 0 or
+        result < std::numeric_limits<T>::min() or
+        result > std::numeric_limits<T>::max())
+    {
+        return false;
+    }
+
+    value = (T) result;
+    return true;
+}
+
+template <typename T>
+typename std::enable_if<std::is_unsigned<T>::value and
+                        not std::is_same<T, bool>::value, bool>::type
+parse_text(const char *text, T &value)
+{
+    /* strtoull quietly wraps negative numbers around */
+    if (text[0] == '-')
+    {
+        return false;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long result = strtoull(text, &end, 10);
+
+    if (end == text or *end != '\0' or errno != 0 or
+        result > std::numeric_limits<T>::max())
+    {
+        return false;
+    }
+
+    value = (T) result;
+    return true;
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, bool>::type
+parse_text(const char *text, T &value)
+{
+    /* Special values like .nan and -.inf are left to yaml-cpp */
+    const char *digits = (text[0] == '-' or text[0] == '+') ? text + 1 : text;
+    if (digits[0] == '.' and isalpha(digits[1]))
+    {
+        return false;
+    }
+
+    std::istringstream stream(text);
+    stream.imbue(std::locale::classic());
+
+    double result;
+    stream >> result;
+
+    if (stream.fail() or stream.peek() != EOF)
+    {
+        return false;
+    }
+
+    value = (T) result;
+    return true;
+}
+
+template <typename T>
+typename std::enable_if<std::is_same<T, bool>::value, bool>::type
+parse_text(const char *text, T &value)
+{
+    if (strcmp(text, "true") == 0)
+    {
+        value = true;
+        return true;
+    }
+    else if (strcmp(text, "false") == 0)
+    {
+        value = false;
+        return true;
+    }
+
+    return false;
+}
+
+template <typename T>
+void decode_level(const YAML::Node &node, uint8_t *&out, const uint8_t *end)
+{
+    if (node.IsSequence())
+    {
+        for (auto item : node)
+        {
+            decode_level<T>(item, out, end);
+        }
+
+        return;
+    }
+
+    if (out + sizeof(T) > end)
+    {
+        throw std::runtime_error("Inline array data does not match its shape");
+    }
+
+    T value;
+    if (not parse_text<T>(node.Scalar().c_str(), value))
+    {
+        value = node.as<T>();
+    }
+
+    memcpy(out, &value, sizeof(T));
+    out += sizeof(T);
+}
+
+template <typename T>
+void decode_elements(const YAML::Node &data, std::vector<uint8_t> &result)
+{
+    uint8_t *out = result.data();
+    const uint8_t *end = out + result.size();
+
+    decode_level<T>(data, out, end);
+
+    if (out != end)
+    {
+        throw std::runtime_error("Inline array data does not match its shape");
+    }
+}
+
+/* Clears the flags of the kinds of number that the node is not */
+void classify(const YAML::Node &node, bool &all_bool, bool &all_int)
+{
+    if (node.IsSequence())
+    {
+        for (auto item : node)
+        {
+            classify(item, all_bool, all_int);
+        }
+
+        return;
+    }
+
+    bool flag;
+    int64_t number;
+    const char *text = node.Scalar().c_str();
+
+    all_bool = all_bool and (parse_text<bool>(text, flag) or
+                             YAML::convert<bool>::decode(node, flag));
+    all_int = all_int and (parse_text<int64_t>(text, number) or
+                           YAML::convert<int64_t>::decode(node, number));
+}
+
+} /* namespace */
+
+YAML::Node encode_inline_data(const uint8_t *data, DType dtype,
+                              const std::vector<size_t> &shape)
+{
+    switch (dtype)
+    {
+        case int8_dtype:
+            return encode_level<int8_t>(data, shape, 0);
+        case int16_dtype:
+            return encode_level<int16_t>(data, shape, 0);
+        case int32_dtype:
+            return encode_level<int32_t>(data, shape, 0);
+        case int64_dtype:
+            return encode_level<int64_t>(data, shape, 0);
+        case uint8_dtype:
+            return encode_level<uint8_t>(data, shape, 0);
+        case uint16_dtype:
+            return encode_level<uint16_t>(data, shape, 0);
+        case uint32_dtype:
+            return encode_level<uint32_t>(data, shape, 0);
+        case uint64_dtype:
+            return encode_level<uint64_t>(data, shape, 0);
+        case float32_dtype:
+            return encode_level<float>(data, shape, 0);
+        case float64_dtype:
+            return encode_level<double>(data, shape, 0);
+        case bool8_dtype:
+            return encode_level<bool>(data, shape, 0);
+        default:
+            break;
+    }
+
+    throw std::runtime_error(
+        "Can't store " + DType_to_string(dtype) + " data in an inline array");
+}
+
+std::vector<uint8_t> decode_inline_data(const YAML::Node &data, DType dtype,
+                                        const std::vector<size_t> &shape)
+{
+    size_t count = 1;
+    for (auto dim : shape)
+    {
+        count *= dim;
+    }
+
+    std::vector<uint8_t> result(count * DType_size(dtype));
+
+    switch (dtype)
+    {
+        case int8_dtype:
+            decode_elements<int8_t>(data, result);
+            break;
+        case int16_dtype:
+            decode_elements<int16_t>(data, result);
+            break;
+        case int32_dtype:
+            decode_elements<int32_t>(data, result);
+            break;
+        case int64_dtype:
+            decode_elements<int64_t>(data, result);
+            break;
+        case uint8_dtype:
+            decode_elements<uint8_t>(data, result);
+            break;
+        case uint16_dtype:
+            decode_elements<uint16_t>(data, result);
+            break;
+        case uint32_dtype:
+            decode_elements<uint32_t>(data, result);
+            break;
+        case uint64_dtype:
+            decode_elements<uint64_t>(data, result);
+            break;
+        case float32_dtype:
+            decode_elements<float>(data, result);
+            break;
+        case float64_dtype:
+            decode_elements<double>(data, result);
+            break;
+        case bool8_dtype:
+            decode_elements<bool>(data, result);
+            break;
+        default:
+            throw std::runtime_error(
+                "Can't read " + DType_to_string(dtype) + " data from an inline array");
+    }
+
+    return result;
+}
+
+std::vector<size_t> inline_data_shape(const YAML::Node &data)
+{
+    std::vector<size_t> shape;
+
+    /* Assigning to a node would modify the tree, so this recurses instead */
+    if (data.IsSequence())
+    {
+        shape.push_back(data.size());
+
+        if (data.size() > 0)
+        {
+            auto inner = inline_data_shape(data[0]);
+            shape.insert(shape.end(), inner.begin(), inner.end());
+        }
+    }
+
+    return shape;
+}
+
+DType infer_inline_dtype(const YAML::Node &data)
+{
+    bool all_bool = true;
+    bool all_int = true;
+
+    classify(data, all_bool, all_int);
+
+    if (all_bool)
+    {
+        return bool8_dtype;
+    }
+
+    return all_int ? int64_dtype : float64_dtype;
+}
+
+} /* namespace Asdf */
@@ -0,0 +1,662 @@
+#include <vector>
+#include <cstring>
+
+#include <asdf-cpp/shuffle.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ASDF_X86_SIMD
+#include <immintrin.h>
+#endif
+
+
+namespace Asdf {
+
+namespace {
+
+/*
+ * The SIMD kernels transpose a group of 16 elements (per 128-bit lane) held
+ * in elem_size vectors. This is done with rounds of byte unpacking, each of
+ * which interleaves pairs of vectors whose indices differ in one bit. In terms
+ * of the bits of a byte's index within the group, a round moves that bit of
+ * the vector index into the lowest bit of the byte position, and the highest
+ * bit of the position takes its place in the vector index. The plan records
+ * the vector index bit used by each round and, in the end, where each vector
+ * belongs.
+ */
+struct TransposePlan
+{
+    size_t rounds;
+    size_t round_bits[4];
+    size_t target[16];
+};
+
+/* Bits 0-3 of a byte's index are element bits, the rest are byte bits */
+#define ELEMENT_BIT(n)  (n)
+#define BYTE_BIT(n)     (4 + (n))
+
+void run_rounds(TransposePlan &plan, int vec_label[4], int pos_label[4],
+                size_t vec_bits, const int *order, size_t rounds)
+{
+    plan.rounds = rounds;
+
+    for (size_t r = 0; r < rounds; r++)
+    {
+        size_t q = 0;
+        while (q < vec_bits && vec_label[q] != order[r])
+        {
+            q++;
+        }
+
+        plan.round_bits[r] = q;
+
+        int popped = pos_label[3];
+        pos_label[3] = pos_label[2];
+        pos_label[2] = pos_label[1];
+        pos_label[1] = pos_label[0];
+        pos_label[0] = vec_label[q];
+        vec_label[q] = popped;
+    }
+}
+
+size_t log2_size(size_t n)
+{
+    size_t bits = 0;
+    while (((size_t) 1 << bits) < n)
+    {
+        bits++;
+    }
+
+    return bits;
+}
+
+/* Elements in, byte planes out: afterwards vector i holds one plane */
+TransposePlan make_shuffle_plan(size_t elem_size)
+{
+    const size_t m = log2_size(elem_size);
+    int vec_label[4], pos_label[4];
+
+    for (size_t j = 0; j < 4; j++)
+    {
+        pos_label[j] = j < m ? BYTE_BIT(j) : ELEMENT_BIT(j - m);
+    }
+
+    for (size_t q = 0; q < m; q++)
+    {
+        vec_label[q] = ELEMENT_BIT(4 + q - m);
+    }
+
+    const int order[] = { ELEMENT_BIT(3), ELEMENT_BIT(2),
+                          ELEMENT_BIT(1), ELEMENT_BIT(0) };
+
+    TransposePlan plan;
+    run_rounds(plan, vec_label, pos_label, m, order, 4);
+
+    for (size_t i = 0; i < elem_size; i++)
+    {
+        size_t plane = 0;
+        for (size_t q = 0; q < m; q++)
+        {
+            plane |= ((i >> q) & 1) << (vec_label[q] - BYTE_BIT(0));
+        }
+
+        plan.target[i] = plane;
+    }
+
+    return plan;
+}
+
+/* Byte planes in, elements out: afterwards vector i holds 16 bytes of them */
+TransposePlan make_unshuffle_plan(size_t elem_size)
+{
+    const size_t m = log2_size(elem_size);
+    int vec_label[4], pos_label[4];
+    int order[4];
+
+    for (size_t j = 0; j < 4; j++)
+    {
+        pos_label[j] = ELEMENT_BIT(j);
+    }
+
+    for (size_t q = 0; q < m; q++)
+    {
+        vec_label[q] = BYTE_BIT(q);
+        order[q] = BYTE_BIT(m - 1 - q);
+    }
+
+    TransposePlan plan;
+    run_rounds(plan, vec_label, pos_label, m, order, m);
+
+    for (size_t i = 0; i < elem_size; i++)
+    {
+        size_t chunk = 0;
+        for (size_t q = 0; q < m; q++)
+        {
+            chunk |= ((i >> q) & 1) << (vec_label[q] - ELEMENT_BIT(4 - m));
+        }
+
+        plan.target[i] = chunk;
+    }
+
+    return plan;
+}
+
+#ifdef ASDF_X86_SIMD
+
+bool cpu_has_avx2(void)
+{
+    static const bool avx2 = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+
+    return avx2;
+}
+
+template <size_t N>
+__attribute__((target("sse2")))
+inline void unpack_rounds_sse2(__m128i *v, const TransposePlan &plan)
+{
+    for (size_t r = 0; r < plan.rounds; r++)
+    {
+        const size_t bit = (size_t) 1 << plan.round_bits[r];
+        __m128i out[N];
+
+        for (size_t q = 0; q < N; q++)
+        {
+            if (not (q & bit))
+            {
+                out[q] = _mm_unpacklo_epi8(v[q], v[q | bit]);
+                out[q | bit] = _mm_unpackhi_epi8(v[q], v[q | bit]);
+            }
+        }
+
+        for (size_t q = 0; q < N; q++)
+        {
+            v[q] = out[q];
+        }
+    }
+}
+
+template <size_t N>
+__attribute__((target("avx2")))
+inline void unpack_rounds_avx2(__m256i *v, const TransposePlan &plan)
+{
+    for (size_t r = 0; r < plan.rounds; r++)
+    {
+        const size_t bit = (size_t) 1 << plan.round_bits[r];
+        __m256i out[N];
+
+        for (size_t q = 0; q < N; q++)
+        {
+            if (not (q & bit))
+            {
+                out[q] = _mm256_unpacklo_epi8(v[q], v[q | bit]);
+                out[q | bit] = _mm256_unpackhi_epi8(v[q], v[q | bit]);
+            }
+        }
+
+        for (size_t q = 0; q < N; q++)
+        {
+            v[q] = out[q];
+        }
+    }
+}
+
+/* Each of these returns the index of the first element it did not handle */
+
+template <size_t N>
+__attribute__((target("sse2")))
+size_t shuffle_sse2(uint8_t *dst, const uint8_t *src, size_t count,
+                    size_t start, const TransposePlan &plan)
+{
+    size_t i = start;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v[N];
+        for (size_t q = 0; q < N; q++)
+        {
+            v[q] = _mm_loadu_si128((const __m128i *)(src + i * N + 16 * q));
+        }
+
+        unpack_rounds_sse2<N>(v, plan);
+
+        for (size_t q = 0; q < N; q++)
+        {
+            _mm_storeu_si128((__m128i *)(dst + plan.target[q] * count + i), v[q]);
+        }
+    }
+
+    return i;
+}
+
+template <size_t N>
+__attribute__((target("sse2")))
+size_t unshuffle_sse2(uint8_t *dst, const uint8_t *src, size_t count,
+                      size_t start, const TransposePlan &plan)
+{
+    size_t i = start;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v[N];
+        for (size_t q = 0; q < N; q++)
+        {
+            v[q] = _mm_loadu_si128((const __m128i *)(src + q * count + i));
+        }
+
+        unpack_rounds_sse2<N>(v, plan);
+
+        for (size_t q = 0; q < N; q++)
+        {
+            _mm_storeu_si128((__m128i *)(dst + i * N + 16 * plan.target[q]), v[q]);
+        }
+    }
+
+    return i;
+}
+
+/*
+ * The AVX2 unpack instructions work within 128-bit lanes, so the kernels
+ * transpose two groups of 16 elements side by side. Conveniently, the two
+ * halves of a plane then end up next to each other.
+ */
+template <size_t N>
+__attribute__((target("avx2")))
+size_t shuffle_avx2(uint8_t *dst, const uint8_t *src, size_t count,
+                    size_t start, const TransposePlan &plan)
+{
+    size_t i = start;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i v[N];
+        for (size_t q = 0; q < N; q++)
+        {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(src + i * N + 16 * q));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(src + (i + 16) * N + 16 * q));
+            v[q] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        }
+
+        unpack_rounds_avx2<N>(v, plan);
+
+        for (size_t q = 0; q < N; q++)
+        {
+            _mm256_storeu_si256((__m256i *)(dst + plan.target[q] * count + i), v[q]);
+        }
+    }
+
+    return i;
+}
+
+template <size_t N>
+__attribute__((target("avx2")))
+size_t unshuffle_avx2(uint8_t *dst, const uint8_t *src, size_t count,
+                      size_t start, const TransposePlan &plan)
+{
+    size_t i = start;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i v[N];
+        for (size_t q = 0; q < N; q++)
+        {
+            v[q] = _mm256_loadu_si256((const __m256i *)(src + q * count + i));
+        }
+
+        unpack_rounds_avx2<N>(v, plan);
+
+        for (size_t q = 0; q < N; q++)
+        {
+            const size_t offset = 16 * plan.target[q];
+            _mm_storeu_si128((__m128i *)(dst + i * N + offset),
+                             _mm256_castsi256_si128(v[q]));
+            _mm_storeu_si128((__m128i *)(dst + (i + 16) * N + offset),
+                             _mm256_extracti128_si256(v[q], 1));
+        }
+    }
+
+    return i;
+}
+
+template <size_t N>
+size_t shuffle_simd(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    static const TransposePlan plan = make_shuffle_plan(N);
+
+    size_t done = 0;
+    if (cpu_has_avx2())
+    {
+        done = shuffle_avx2<N>(dst, src, count, done, plan);
+    }
+
+    return shuffle_sse2<N>(dst, src, count, done, plan);
+}
+
+template <size_t N>
+size_t unshuffle_simd(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    static const TransposePlan plan = make_unshuffle_plan(N);
+
+    size_t done = 0;
+    if (cpu_has_avx2())
+    {
+        done = unshuffle_avx2<N>(dst, src, count, done, plan);
+    }
+
+    return unshuffle_sse2<N>(dst, src, count, done, plan);
+}
+
+/*
+ * Bit transposes of a byte plane, as done by transpose_plane_bits below. Going
+ * forward, movemask collects the top bit of every byte in a vector, which is
+ * bit k of eight consecutive bytes for each group. Adding the vector to itself
+ * then moves the next bit up. Going back, the row bytes of each group are
+ * broadcast to its eight output bytes and every output byte tests its own bit.
+ * Each of these returns the number of groups it handled.
+ */
+__attribute__((target("sse2")))
+size_t transpose_bits_sse2(uint8_t *dst, const uint8_t *src, size_t groups)
+{
+    size_t g = 0;
+    for (; g + 2 <= groups; g += 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 8 * g));
+        for (int k = 7; k >= 0; k--)
+        {
+            const uint16_t row = (uint16_t) _mm_movemask_epi8(v);
+            memcpy(dst + k * groups + g, &row, sizeof(row));
+            v = _mm_add_epi8(v, v);
+        }
+    }
+
+    return g;
+}
+
+__attribute__((target("avx2")))
+size_t transpose_bits_avx2(uint8_t *dst, const uint8_t *src, size_t groups)
+{
+    size_t g = 0;
+    for (; g + 4 <= groups; g += 4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + 8 * g));
+        for (int k = 7; k >= 0; k--)
+        {
+            const uint32_t row = (uint32_t) _mm256_movemask_epi8(v);
+            memcpy(dst + k * groups + g, &row, sizeof(row));
+            v = _mm256_add_epi8(v, v);
+        }
+    }
+
+    return g;
+}
+
+__attribute__((target("sse2")))
+size_t untranspose_bits_sse2(uint8_t *dst, const uint8_t *src, size_t groups)
+{
+    const __m128i bits = _mm_set1_epi64x(0x8040201008040201ll);
+
+    size_t g = 0;
+    for (; g + 2 <= groups; g += 2)
+    {
+        __m128i out = _mm_setzero_si128();
+        for (int k = 7; k >= 0; k--)
+        {
+            uint16_t row;
+            memcpy(&row, src + k * groups + g, sizeof(row));
+
+            /* Eight copies of the first row byte, then eight of the second */
+            __m128i x = _mm_cvtsi32_si128(row);
+            x = _mm_unpacklo_epi8(x, x);
+            x = _mm_unpacklo_epi16(x, x);
+            x = _mm_unpacklo_epi32(x, x);
+
+            const __m128i set = _mm_cmpeq_epi8(_mm_and_si128(x, bits), bits);
+            out = _mm_sub_epi8(_mm_add_epi8(out, out), set);
+        }
+
+        _mm_storeu_si128((__m128i *)(dst + 8 * g), out);
+    }
+
+    return g;
+}
+
+__attribute__((target("avx2")))
+size_t untranspose_bits_avx2(uint8_t *dst, const uint8_t *src, size_t groups)
+{
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201ll);
+    const __m256i spread = _mm256_set_epi64x(0x0303030303030303ll,
+                                             0x0202020202020202ll,
+                                             0x0101010101010101ll, 0);
+
+    size_t g = 0;
+    for (; g + 4 <= groups; g += 4)
+    {
+        __m256i out = _mm256_setzero_si256();
+        for (int k = 7; k >= 0; k--)
+        {
+            uint32_t row;
+            memcpy(&row, src + k * groups + g, sizeof(row));
+
+            const __m256i x = _mm256_shuffle_epi8(
+                    _mm256_set1_epi32((int) row), spread);
+            const __m256i set = _mm256_cmpeq_epi8(
+                    _mm256_and_si256(x, bits), bits);
+            out = _mm256_sub_epi8(_mm256_add_epi8(out, out), set);
+        }
+
+        _mm256_storeu_si256((__m256i *)(dst + 8 * g), out);
+    }
+
+    return g;
+}
+
+#endif /* ASDF_X86_SIMD */
+
+void shuffle_bytes(uint8_t *dst, const uint8_t *src, size_t count,
+                   size_t elem_size)
+{
+    size_t done = 0;
+
+#ifdef ASDF_X86_SIMD
+    switch (elem_size)
+    {
+        case 2:
+            done = shuffle_simd<2>(dst, src, count);
+            break;
+        case 4:
+            done = shuffle_simd<4>(dst, src, count);
+            break;
+        case 8:
+            done = shuffle_simd<8>(dst, src, count);
+            break;
+        case 16:
+            done = shuffle_simd<16>(dst, src, count);
+            break;
+        default:
+            break;
+    }
+#endif
+
+    for (size_t j = 0; j < elem_size; j++)
+    {
+        for (size_t i = done; i < count; i++)
+        {
+            dst[j * count + i] = src[i * elem_size + j];
+        }
+    }
+}
+
+void unshuffle_bytes(uint8_t *dst, const uint8_t *src, size_t count,
+                     size_t elem_size)
+{
+    size_t done = 0;
+
+#ifdef ASDF_X86_SIMD
+    switch (elem_size)
+    {
+        case 2:
+            done = unshuffle_simd<2>(dst, src, count);
+            break;
+        case 4:
+            done = unshuffle_simd<4>(dst, src, count);
+            break;
+        case 8:
+            done = unshuffle_simd<8>(dst, src, count);
+            break;
+        case 16:
+            done = unshuffle_simd<16>(dst, src, count);
+            break;
+        default:
+            break;
+    }
+#endif
+
+    for (size_t i = done; i < count; i++)
+    {
+        for (size_t j = 0; j < elem_size; j++)
+        {
+            dst[i * elem_size + j] = src[j * count + i];
+        }
+    }
+}
+
+/*
+ * Transposes an 8x8 bit matrix, where bit k of byte i is bit 8i+k of the
+ * word (Hacker's Delight, section 7-3). This is its own inverse.
+ */
+inline uint64_t transpose_8x8(uint64_t x)
+{
+    uint64_t t;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+    x = x ^ t ^ (t << 28);
+
+    return x;
+}
+
+inline uint64_t load_le64(const uint8_t *src)
+{
+    uint64_t x = 0;
+    for (size_t i = 0; i < 8; i++)
+    {
+        x |= (uint64_t) src[i] << (8 * i);
+    }
+
+    return x;
+}
+
+/* Bit k of byte 8g+i of a plane goes to bit i of byte g of row k */
+void transpose_plane_bits(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    const size_t groups = count / 8;
+    size_t g = 0;
+
+#ifdef ASDF_X86_SIMD
+    g = cpu_has_avx2() ? transpose_bits_avx2(dst, src, groups) :
+                         transpose_bits_sse2(dst, src, groups);
+#endif
+
+    for (; g < groups; g++)
+    {
+        uint64_t x = transpose_8x8(load_le64(src + 8 * g));
+        for (size_t k = 0; k < 8; k++)
+        {
+            dst[k * groups + g] = (uint8_t) (x >> (8 * k));
+        }
+    }
+
+    memcpy(dst + 8 * groups, src + 8 * groups, count - 8 * groups);
+}
+
+void untranspose_plane_bits(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    const size_t groups = count / 8;
+    size_t g = 0;
+
+#ifdef ASDF_X86_SIMD
+    g = cpu_has_avx2() ? untranspose_bits_avx2(dst, src, groups) :
+                         untranspose_bits_sse2(dst, src, groups);
+#endif
+
+    for (; g < groups; g++)
+    {
+        uint64_t x = 0;
+        for (size_t k = 0; k < 8; k++)
+        {
+            x |= (uint64_t) src[k * groups + g] << (8 * k);
+        }
+
+        x = transpose_8x8(x);
+        for (size_t i = 0; i < 8; i++)
+        {
+            dst[8 * g + i] = (uint8_t) (x >> (8 * i));
+        }
+    }
+
+    memcpy(dst + 8 * groups, src + 8 * groups, count - 8 * groups);
+}
+
+} /* namespace */
+
+void shuffle_data(uint8_t *dst, const uint8_t *src, size_t count,
+                  size_t elem_size, ShuffleType shuffle)
+{
+    if (shuffle == no_shuffle)
+    {
+        memcpy(dst, src, count * elem_size);
+        return;
+    }
+
+    if (shuffle == byte_shuffle)
+    {
+        if (elem_size == 1)
+        {
+            memcpy(dst, src, count);
+            return;
+        }
+
+        shuffle_bytes(dst, src, count, elem_size);
+        return;
+    }
+
+    std::vector<uint8_t> planes(count * elem_size);
+    shuffle_bytes(planes.data(), src, count, elem_size);
+
+    for (size_t j = 0; j < elem_size; j++)
+    {
+        transpose_plane_bits(dst + j * count, planes.data() + j * count, count);
+    }
+}
+
+void unshuffle_data(uint8_t *dst, const uint8_t *src, size_t count,
+                    size_t elem_size, ShuffleType shuffle)
+{
+    if (shuffle == no_shuffle)
+    {
+        memcpy(dst, src, count * elem_size);
+        return;
+    }
+
+    if (shuffle == byte_shuffle)
+    {
+        if (elem_size == 1)
+        {
+            memcpy(dst, src, count);
+            return;
+        }
+
+        unshuffle_bytes(dst, src, count, elem_size);
+        return;
+    }
+
+    std::vector<uint8_t> planes(count * elem_size);
+    for (size_t j = 0; j < elem_size; j++)
+    {
+        untranspose_plane_bits(planes.data() + j * count, src + j * count, count);
+    }
+
+    unshuffle_bytes(dst, planes.data(), count, elem_size);
+}
+
+} /* namespace Asdf */
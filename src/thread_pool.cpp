@@ -0,0 +1,87 @@
+#include <asdf-cpp/thread_pool.hpp>
+
+
+namespace Asdf {
+
+namespace {
+
+thread_local bool worker_thread = false;
+
+} /* namespace */
+
+bool ThreadPool::in_worker()
+{
+    return worker_thread;
+}
+
+ThreadPool::ThreadPool(size_t num_threads)
+{
+    if (num_threads == 0)
+    {
+        num_threads = std::thread::hardware_concurrency();
+    }
+
+    /* hardware_concurrency may return 0 if it is unable to tell */
+    if (num_threads == 0)
+    {
+        num_threads = 1;
+    }
+
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        workers.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        stopping = true;
+    }
+
+    condition.notify_all();
+
+    /* Any tasks that are still queued are completed before we return */
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        tasks.push(task);
+    }
+
+    condition.notify_one();
+}
+
+void ThreadPool::run()
+{
+    worker_thread = true;
+
+    for (;;)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            condition.wait(guard, [this] { return stopping or not tasks.empty(); });
+
+            if (tasks.empty())
+            {
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+
+        task();
+    }
+}
+
+} /* namespace Asdf */
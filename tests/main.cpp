@@ -1,6 +1,36 @@
+#include <string>
+#include <stdexcept>
+
+#include <cstdlib>
+
+#include <ftw.h>
+#include <unistd.h>
+
 #include "gtest/gtest.h"
 
 std::string test_data_path;
+std::string test_output_path;
+
+static int remove_entry(const char *path, const struct stat *, int,
+                        struct FTW *)
+{
+  return remove(path);
+}
+
+/* Files written by the tests go to a scratch directory, not the data dir */
+static std::string make_output_dir(void)
+{
+  const char *tmpdir = getenv("TMPDIR");
+  std::string pattern = std::string(tmpdir ? tmpdir : "/tmp") +
+                        "/asdf-cpp-tests-XXXXXX";
+
+  if (mkdtemp(&pattern[0]) == nullptr)
+  {
+    throw std::runtime_error("Unable to create test output directory");
+  }
+
+  return pattern + "/";
+}
 
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -8,6 +38,11 @@ int main(int argc, char** argv) {
   /* Configure test data path for all unit tests */
   assert (argc == 2);
   test_data_path = std::string(argv[1]) + "/";
+  test_output_path = make_output_dir();
+
+  const int result = RUN_ALL_TESTS();
+
+  nftw(test_output_path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
 
-  return RUN_ALL_TESTS();
+  return result;
 }
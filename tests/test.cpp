@@ -1,11 +1,20 @@
 #include <string>
 #include <sstream>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cmath>
+#include <locale>
+#include <stdexcept>
+
+#include <sys/stat.h>
 
 #include <asdf-cpp/asdf.hpp>
 
 #include "gtest/gtest.h"
 
 extern std::string test_data_path;
+extern std::string test_output_path;
 using namespace Asdf;
 
 TEST(ReaderTest, Tag)
@@ -43,3 +52,935 @@ TEST(ReaderTest, FromStream)
         EXPECT_EQ(data[i], i);
     }
 }
+
+static std::string write_int_arrays(size_t count, size_t length)
+{
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+
+    std::vector<std::vector<int>> arrays(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < length; j++)
+        {
+            arrays[i].push_back(i * length + j);
+        }
+
+        tree["array" + std::to_string(i)] =
+            asdf.create_array_node<int>(arrays[i].data(), length);
+    }
+
+    std::stringstream stream;
+    stream << asdf;
+    return stream.str();
+}
+
+static void verify_int_arrays(std::string contents, size_t count, size_t length)
+{
+    std::stringstream stream(contents);
+    AsdfFile asdf(stream);
+    Node tree = asdf.get_tree();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto array = asdf.get_array<int>(tree["array" + std::to_string(i)]);
+        int *data = array.get_raw_data();
+        for (size_t j = 0; j < length; j++)
+        {
+            ASSERT_EQ(data[j], (int) (i * length + j));
+        }
+    }
+}
+
+TEST(BlockIndexTest, WriteIndex)
+{
+    std::string contents = write_int_arrays(3, 100);
+
+    size_t index = contents.rfind(BLOCK_INDEX_HEADER);
+    ASSERT_NE(index, std::string::npos);
+
+    std::vector<size_t> offsets;
+    auto begin = (const uint8_t *) contents.data();
+    auto end = begin + contents.size();
+    ASSERT_EQ(read_block_index(offsets, begin, end), begin + index);
+    ASSERT_EQ(offsets.size(), 3);
+
+    for (auto offset : offsets)
+    {
+        EXPECT_EQ(memcmp(begin + offset, asdf_block_magic, 4), 0);
+    }
+
+    verify_int_arrays(contents, 3, 100);
+}
+
+TEST(BlockIndexTest, ReadExistingIndex)
+{
+    Asdf::AsdfFile asdf(test_data_path + std::string("test.asdf"));
+    auto array = asdf.get_array<int64_t>(asdf.get_tree()["top"]["nums"]);
+    int64_t *data = array.get_raw_data();
+    for (int i = 0; i < 100; i++)
+    {
+        EXPECT_EQ(data[i], i);
+    }
+}
+
+TEST(BlockIndexTest, StaleIndex)
+{
+    std::string contents = write_int_arrays(3, 100);
+
+    std::vector<size_t> offsets;
+    auto begin = (const uint8_t *) contents.data();
+    auto end = begin + contents.size();
+    auto index = read_block_index(offsets, begin, end);
+    ASSERT_NE(index, nullptr);
+
+    /*
+     * Point the middle entry somewhere inside of a block. The first and last
+     * entries are still correct, so this is only detected on access.
+     */
+    std::stringstream stale;
+    stale.write(contents.data(), index - begin);
+    write_block_index(stale, { offsets[0], offsets[1] + 16, offsets[2] });
+    verify_int_arrays(stale.str(), 3, 100);
+
+    /* Completely bogus offsets are rejected when the file is opened */
+    std::stringstream bogus;
+    bogus.write(contents.data(), index - begin);
+    write_block_index(bogus, { 1, 2, 3 });
+    verify_int_arrays(bogus.str(), 3, 100);
+}
+
+TEST(ReaderTest, TreeEndMarker)
+{
+    /* The end marker may be the last thing in the file or use CRLF */
+    std::string endings[] = { "...", "...\r\n", "...\n" };
+
+    for (auto ending : endings)
+    {
+        std::stringstream stream;
+        stream << "#ASDF 1.0.0\n#ASDF_STANDARD 1.2.0\n%YAML 1.1\n";
+        stream << "--- !core/asdf-1.1.0\nfoo: bar\nbaz: ...not the end\n";
+        stream << ending;
+
+        AsdfFile asdf(stream);
+        EXPECT_EQ(asdf["foo"].as<std::string>(), "bar");
+        EXPECT_EQ(asdf["baz"].as<std::string>(), "...not the end");
+    }
+}
+
+TEST(ReaderTest, InvalidHeader)
+{
+    std::stringstream stream;
+    stream << "#ASDF 1.0.0\n%YAML 1.1\n--- {}\n...\n";
+
+    EXPECT_THROW(AsdfFile asdf(stream), std::runtime_error);
+}
+
+TEST(ReaderTest, ReadInto)
+{
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+
+    std::vector<int> nums;
+    for (int i = 0; i < 1000; i++)
+    {
+        nums.push_back(i);
+    }
+
+    tree["raw"] = asdf.create_array_node<int>(nums.data(), nums.size());
+    tree["zlib"] = asdf.create_array_node<int>(nums.data(), nums.size(),
+                                               CompressionType::zlib);
+
+    std::stringstream asdf_stream;
+    asdf_stream << asdf;
+
+    AsdfFile new_asdf(asdf_stream);
+    for (auto name : { "raw", "zlib" })
+    {
+        auto array = new_asdf.get_array<int>(new_asdf[name]);
+        ASSERT_EQ(array.get_num_elements(), 1000);
+
+        std::vector<int> buffer(1000);
+        EXPECT_EQ(array.read_into(buffer.data(), buffer.size()), 1000);
+        EXPECT_EQ(buffer, nums);
+
+        auto allocated = array.read(std::allocator<int>());
+        EXPECT_TRUE(std::equal(nums.begin(), nums.end(), allocated.get()));
+
+        EXPECT_THROW(array.read_into(buffer.data(), 999), std::runtime_error);
+    }
+}
+
+TEST(ReaderTest, ReadArrays)
+{
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+
+    const int num_arrays = 16;
+    std::vector<int> nums;
+    for (int i = 0; i < 10000; i++)
+    {
+        nums.push_back(i);
+    }
+
+    for (int i = 0; i < num_arrays; i++)
+    {
+        auto compression = i % 2 ? CompressionType::zlib : CompressionType::none;
+        tree["array" + std::to_string(i)] =
+            asdf.create_array_node<int>(nums.data(), nums.size(), compression);
+    }
+
+    std::stringstream asdf_stream;
+    asdf_stream << asdf;
+
+    AsdfFile new_asdf(asdf_stream);
+    new_asdf.set_num_threads(4);
+    EXPECT_EQ(new_asdf.get_thread_pool().get_num_threads(), 4);
+
+    std::vector<Node> nodes;
+    for (int i = 0; i < num_arrays; i++)
+    {
+        nodes.push_back(new_asdf["array" + std::to_string(i)]);
+    }
+
+    auto futures = new_asdf.read_arrays<int>(nodes);
+    ASSERT_EQ(futures.size(), num_arrays);
+
+    for (auto &future : futures)
+    {
+        auto data = future.get();
+        EXPECT_TRUE(std::equal(nums.begin(), nums.end(), data.get()));
+    }
+}
+
+TEST(WriterTest, ParallelWrite)
+{
+    std::vector<int> nums;
+    for (int i = 0; i < 10000; i++)
+    {
+        nums.push_back(i * 7);
+    }
+
+    auto write = [&nums](bool parallel, size_t max_in_flight) {
+        AsdfFile asdf;
+        Node tree = asdf.get_tree();
+
+        for (int i = 0; i < 12; i++)
+        {
+            CompressionType compression[] = { zlib, bzip2, none };
+            tree["array" + std::to_string(i)] = asdf.create_array_node<int>(
+                    nums.data(), nums.size(), compression[i % 3]);
+        }
+
+        asdf.set_num_threads(4);
+        asdf.set_parallel_write(parallel, max_in_flight);
+
+        std::stringstream stream;
+        stream << asdf;
+        return stream.str();
+    };
+
+    std::string serial = write(false, 0);
+
+    /* The output must not depend on how the blocks were compressed */
+    EXPECT_EQ(write(true, DEFAULT_MAX_IN_FLIGHT), serial);
+    EXPECT_EQ(write(true, 1), serial);
+
+    std::stringstream stream(serial);
+    AsdfFile asdf(stream);
+    for (int i = 0; i < 12; i++)
+    {
+        auto data = asdf.get_array<int>(asdf["array" + std::to_string(i)]).read();
+        EXPECT_TRUE(std::equal(nums.begin(), nums.end(), data.get()));
+    }
+}
+
+/* Behaves like a pipe: output can only be appended and seeking fails */
+class ForwardOnlyBuf : public std::streambuf
+{
+    public:
+        std::string contents;
+
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize n)
+        {
+            contents.append(s, n);
+            return n;
+        }
+
+        int_type overflow(int_type c)
+        {
+            contents.push_back(c);
+            return c;
+        }
+};
+
+TEST(WriterTest, NonSeekableOutput)
+{
+    std::vector<int> nums;
+    for (int i = 0; i < 1000; i++)
+    {
+        nums.push_back(i);
+    }
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+    tree["zlib"] = asdf.create_array_node<int>(nums.data(), nums.size(), zlib);
+    tree["bzp2"] = asdf.create_array_node<int>(nums.data(), nums.size(), bzip2);
+    tree["raw"] = asdf.create_array_node<int>(nums.data(), nums.size());
+
+    std::stringstream seekable;
+    seekable << asdf;
+
+    ForwardOnlyBuf buffer;
+    std::ostream pipe(&buffer);
+    ASSERT_EQ(pipe.tellp(), std::streampos(-1));
+
+    pipe << asdf;
+    EXPECT_TRUE(pipe.good());
+    EXPECT_EQ(buffer.contents, seekable.str());
+}
+
+TEST(WriterTest, FileDescriptor)
+{
+    /* Large enough that the raw block bypasses the gather buffer */
+    std::vector<int> nums;
+    for (int i = 0; i < 100000; i++)
+    {
+        nums.push_back(i);
+    }
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+    tree["zlib"] = asdf.create_array_node<int>(nums.data(), nums.size(), zlib);
+    tree["raw"] = asdf.create_array_node<int>(nums.data(), nums.size());
+    tree["small"] = asdf.create_array_node<int>(nums.data(), 10);
+
+    std::stringstream expected;
+    expected << asdf;
+
+    for (bool direct_io : { false, true })
+    {
+        std::string path = test_output_path + "fd-writer.asdf";
+        asdf.write_to(path, direct_io);
+
+        std::ifstream ifs(path);
+        std::string contents((std::istreambuf_iterator<char>(ifs)),
+                             std::istreambuf_iterator<char>());
+        EXPECT_EQ(contents, expected.str());
+    }
+}
+
+TEST(WriterTest, FileWriterReleasesReserve)
+{
+    /* Compresses to a tiny fraction of the space reserved for it */
+    std::vector<int> zeros(1 << 20, 0);
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+    tree["zeros"] = asdf.create_array_node<int>(zeros.data(), zeros.size(),
+                                                zlib);
+
+    for (bool direct_io : { false, true })
+    {
+        std::string path = test_output_path + "fd-writer-reserve.asdf";
+        asdf.write_to(path, direct_io);
+
+        struct stat info;
+        ASSERT_EQ(stat(path.c_str(), &info), 0);
+        EXPECT_LT((size_t) info.st_blocks * 512, 256ul << 10);
+    }
+}
+
+TEST(WriterTest, StreamedArray)
+{
+    std::vector<int> nums { 1, 2, 3 };
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+    tree["nums"] = asdf.create_array_node<int>(nums.data(), nums.size());
+    tree["rows"] = asdf.create_streamed_array_node<double>({ 4 });
+
+    EXPECT_THROW(asdf.create_streamed_array_node<double>(), std::runtime_error);
+    EXPECT_EQ(tree["rows"]["source"].as<int>(), -1);
+    EXPECT_EQ(tree["rows"]["shape"][0].as<std::string>(), "*");
+
+    std::stringstream stream;
+    {
+        /* A tiny buffer makes sure that rows are written out along the way */
+        auto writer = asdf.write_streamed<double>(stream, 64);
+
+        double row[4];
+        for (int i = 0; i < 100; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                row[j] = i * 4 + j;
+            }
+
+            writer.append(row, 1);
+        }
+
+        EXPECT_EQ(writer.get_num_rows(), 100);
+    }
+
+    /* Incomplete rows at the end of the file are ignored */
+    stream << "xyz";
+
+    AsdfFile new_asdf(stream);
+    auto rows = new_asdf.get_array<double>(new_asdf["rows"]);
+    EXPECT_TRUE(rows.is_streamed());
+    EXPECT_EQ(rows.get_shape(), std::vector<size_t>({ 100, 4 }));
+
+    auto data = rows.read();
+    for (int i = 0; i < 400; i++)
+    {
+        ASSERT_EQ(data.get()[i], i);
+    }
+
+    auto num_array = new_asdf.get_array<int>(new_asdf["nums"]);
+    EXPECT_EQ(num_array.get_raw_data()[2], 3);
+}
+
+TEST(ChecksumTest, WriteAndVerify)
+{
+    std::vector<int> nums;
+    for (int i = 0; i < 1000; i++)
+    {
+        nums.push_back(i);
+    }
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+    tree["raw"] = asdf.create_array_node<int>(nums.data(), nums.size());
+    tree["zlib"] = asdf.create_array_node<int>(nums.data(), nums.size(), zlib);
+
+    std::stringstream stream;
+    stream << asdf;
+    std::string contents = stream.str();
+
+    {
+        std::stringstream copy(contents);
+        AsdfFile new_asdf(copy);
+        EXPECT_TRUE(new_asdf.verify_checksums().empty());
+
+        /* The checksum covers the raw data as it is stored */
+        auto array = new_asdf.get_array<int>(new_asdf["raw"]);
+        auto header = (const block_header_t *)
+            ((const uint8_t *) array.get_raw_data() - sizeof(block_header_t));
+        uint8_t checksum[16];
+        compute_checksum(checksum, (const uint8_t *) nums.data(), 4000);
+        EXPECT_EQ(memcmp(header->checksum, checksum, 16), 0);
+    }
+
+    /* Corrupt a byte in the compressed block */
+    size_t index = contents.rfind(BLOCK_INDEX_HEADER);
+    contents[index - 10] ^= 0xff;
+
+    std::stringstream corrupted(contents);
+    AsdfFile bad_asdf(corrupted);
+    auto result = bad_asdf.verify_checksums_async();
+    EXPECT_EQ(result.get(), std::vector<int>({ 1 }));
+}
+
+TEST(ChecksumTest, Disabled)
+{
+    std::vector<int> nums(100, 5);
+
+    AsdfFile asdf;
+    asdf.set_checksums(false);
+    asdf.get_tree()["nums"] = asdf.create_array_node<int>(nums.data(), 100);
+
+    std::stringstream stream;
+    stream << asdf;
+
+    AsdfFile new_asdf(stream);
+    auto array = new_asdf.get_array<int>(new_asdf["nums"]);
+    auto header = (const block_header_t *)
+        ((const uint8_t *) array.get_raw_data() - sizeof(block_header_t));
+
+    const uint8_t zeros[16] = { 0 };
+    EXPECT_EQ(memcmp(header->checksum, zeros, 16), 0);
+    EXPECT_TRUE(new_asdf.verify_checksums().empty());
+}
+
+TEST(CompressionTest, ZstdAndLz4)
+{
+    /* Large enough that lz4 splits the block into several chunks */
+    std::vector<int> nums;
+    for (int i = 0; i < 1500000; i++)
+    {
+        nums.push_back(i % 1000);
+    }
+
+    for (CompressionType compression : { zstd, lz4 })
+    {
+        if (not is_compression_supported(compression))
+        {
+            continue;
+        }
+
+        AsdfFile asdf;
+        asdf.get_tree()["nums"] = asdf.create_array_node<int>(
+                nums.data(), nums.size(), compression);
+
+        std::stringstream stream;
+        stream << asdf;
+
+        AsdfFile new_asdf(stream);
+        auto array = new_asdf.get_array<int>(new_asdf["nums"]);
+        EXPECT_EQ(array.get_compression_type(), compression);
+
+        auto data = array.read();
+        EXPECT_TRUE(std::equal(nums.begin(), nums.end(), data.get()));
+        EXPECT_TRUE(new_asdf.verify_checksums().empty());
+    }
+}
+
+TEST(CompressionTest, Lz4Layout)
+{
+    if (not is_compression_supported(lz4))
+    {
+        return;
+    }
+
+    std::vector<int> nums(100, 1);
+
+    AsdfFile asdf;
+    asdf.get_tree()["nums"] = asdf.create_array_node<int>(nums.data(), 100, lz4);
+
+    std::stringstream stream;
+    stream << asdf;
+
+    AsdfFile new_asdf(stream);
+    auto array = new_asdf.get_array<int>(new_asdf["nums"]);
+    auto block = (const uint8_t *) array.get_raw_data();
+    auto header = (const block_header_t *) (block - sizeof(block_header_t));
+
+    /* Python asdf pads the code with a NUL byte */
+    EXPECT_EQ(memcmp(header->compression, "lz4\0", 4), 0);
+
+    /* One chunk: big-endian length, then little-endian uncompressed size */
+    uint32_t length = (block[0] << 24) | (block[1] << 16) | (block[2] << 8) | block[3];
+    uint32_t size = block[4] | (block[5] << 8) | (block[6] << 16) | (block[7] << 24);
+    EXPECT_EQ(length + 4, header->get_used_size());
+    EXPECT_EQ(size, 400);
+}
+
+TEST(CompressionTest, Options)
+{
+    std::vector<int> nums;
+    for (int i = 0; i < 10000; i++)
+    {
+        nums.push_back((i * 7) % 1000);
+    }
+
+    auto write = [&nums](CompressionOptions options) {
+        AsdfFile asdf;
+        asdf.get_tree()["nums"] = asdf.create_array_node<int>(
+                nums.data(), nums.size(), options);
+
+        std::stringstream stream;
+        stream << asdf;
+        return stream.str();
+    };
+
+    auto block_size = [&nums](std::string contents) {
+        std::stringstream stream(contents);
+        AsdfFile asdf(stream);
+
+        auto array = asdf.get_array<int>(asdf["nums"]);
+        auto data = array.read();
+        EXPECT_TRUE(std::equal(nums.begin(), nums.end(), data.get()));
+
+        auto header = (const block_header_t *)
+            ((const uint8_t *) array.get_raw_data() - sizeof(block_header_t));
+        return header->get_used_size();
+    };
+
+    /* A plain CompressionType uses the defaults */
+    EXPECT_EQ(write(zlib), write(CompressionOptions(zlib)));
+
+    size_t fast = block_size(write(CompressionOptions(zlib, 1)));
+    size_t best = block_size(write(CompressionOptions(zlib, 9)));
+    EXPECT_LT(best, fast);
+
+    /* Z_RLE, with a tiny scratch buffer */
+    block_size(write(CompressionOptions(zlib, 6, 3, 16)));
+    block_size(write(CompressionOptions(bzip2, 1, 0, 16)));
+
+    /* Invalid options are reported instead of hanging or being ignored */
+    for (CompressionType compression : { zlib, bzip2, zstd, lz4 })
+    {
+        if (is_compression_supported(compression))
+        {
+            EXPECT_THROW(write(CompressionOptions(compression,
+                    COMPRESSION_LEVEL_DEFAULT, 0, 0)), std::runtime_error);
+        }
+    }
+
+    if (is_compression_supported(zstd))
+    {
+        EXPECT_THROW(write(CompressionOptions(zstd, 3, 1000)),
+                     std::runtime_error);
+    }
+}
+
+TEST(CompressionTest, SwappedRead)
+{
+    /* Several decompression windows, and a few more lz4 chunks */
+    std::vector<uint64_t> nums, swapped;
+    for (uint64_t i = 0; i < 1200000; i++)
+    {
+        nums.push_back(i * 3);
+        swapped.push_back(bswap_64(i * 3));
+    }
+
+    const std::string other_order =
+        get_system_byte_order() == "little" ? "big" : "little";
+
+    for (CompressionType compression : { none, zlib, bzip2, zstd, lz4 })
+    {
+        if (compression != none && not is_compression_supported(compression))
+        {
+            continue;
+        }
+
+        /* The data is stored pre-swapped, and the tree says so */
+        AsdfFile asdf;
+        Node tree = asdf.get_tree();
+        tree["nums"] = asdf.create_array_node<uint64_t>(
+                swapped.data(), swapped.size(), compression);
+        tree["nums"]["byteorder"] = other_order;
+
+        std::stringstream stream;
+        stream << asdf;
+
+        AsdfFile new_asdf(stream);
+        auto array = new_asdf.get_array<uint64_t>(new_asdf["nums"]);
+
+        auto data = array.read();
+        EXPECT_TRUE(std::equal(nums.begin(), nums.end(), data.get()))
+            << CompressionType_to_string(compression);
+    }
+}
+
+TEST(WriterTest, ByteOrder)
+{
+    std::vector<uint32_t> nums;
+    for (uint32_t i = 0; i < 300000; i++)
+    {
+        nums.push_back(i * 7);
+    }
+
+    const std::vector<uint32_t> original = nums;
+
+    for (CompressionType compression : { none, zlib, zstd, lz4 })
+    {
+        if (compression != none && not is_compression_supported(compression))
+        {
+            continue;
+        }
+
+        for (ByteOrder order : { little_endian, big_endian })
+        {
+            auto write = [&](bool parallel) {
+                CompressionOptions options(compression);
+                options.shuffle = byte_shuffle;
+
+                AsdfFile asdf;
+                Node tree = asdf.get_tree();
+                tree["plain"] = asdf.create_array_node<uint32_t>(
+                        nums.data(), nums.size(), compression, order);
+                tree["shuffled"] = asdf.create_array_node<uint32_t>(
+                        nums.data(), nums.size(), options, order);
+                tree["chunked"] = asdf.create_array_node<uint32_t>(
+                        nums.data(), std::vector<size_t> { 600, 500 },
+                        compression, std::vector<size_t> { 256, 256 }, order);
+
+                asdf.set_num_threads(2);
+                asdf.set_parallel_write(parallel);
+
+                std::stringstream stream;
+                stream << asdf;
+                return stream.str();
+            };
+
+            std::stringstream stream(write(false));
+            EXPECT_EQ(write(true), stream.str());
+
+            /* The caller's data is never swapped in place */
+            EXPECT_EQ(nums, original);
+
+            AsdfFile new_asdf(stream);
+            EXPECT_TRUE(new_asdf.verify_checksums().empty());
+
+            for (auto name : { "plain", "shuffled", "chunked" })
+            {
+                EXPECT_EQ(new_asdf[name]["byteorder"].as<std::string>(),
+                          ByteOrder_to_string(order));
+
+                auto array = new_asdf.get_array<uint32_t>(new_asdf[name]);
+                auto data = array.read();
+                EXPECT_TRUE(std::equal(nums.begin(), nums.end(), data.get()))
+                    << name << " " << CompressionType_to_string(compression);
+            }
+
+            /* Check the raw bytes of the uncompressed block */
+            if (compression == none)
+            {
+                auto array = new_asdf.get_array<uint32_t>(new_asdf["plain"]);
+                const uint8_t *raw = (const uint8_t *) array.get_raw_data();
+                uint8_t expected = order == big_endian ? 0 : 7;
+                EXPECT_EQ(raw[4], expected);
+            }
+        }
+    }
+}
+
+TEST(WriterTest, BlockDedup)
+{
+    std::vector<uint8_t> mask(5000), copy(5000), other(5000);
+    for (size_t i = 0; i < mask.size(); i++)
+    {
+        mask[i] = (i % 7) == 0;
+        other[i] = (i % 5) == 0;
+    }
+
+    copy = mask;
+
+    for (DedupMode mode : { no_dedup, dedup_identity, dedup_content })
+    {
+        AsdfFile asdf;
+        asdf.set_block_dedup(mode);
+
+        Node tree = asdf.get_tree();
+        tree["a"] = asdf.create_array_node<uint8_t>(mask.data(), mask.size(),
+                                                    CompressionType::zlib);
+        tree["b"] = asdf.create_array_node<uint8_t>(mask.data(), mask.size(),
+                                                    CompressionType::zlib);
+        tree["c"] = asdf.create_array_node<uint8_t>(copy.data(), copy.size(),
+                                                    CompressionType::zlib);
+        tree["d"] = asdf.create_array_node<uint8_t>(other.data(), other.size(),
+                                                    CompressionType::zlib);
+        /* The same data is encoded differently, so it needs its own block */
+        tree["e"] = asdf.create_array_node<uint8_t>(mask.data(), mask.size());
+
+        std::stringstream stream;
+        stream << asdf;
+
+        AsdfFile result(stream);
+        auto source = [&](const char *name) {
+            return result[name]["source"].as<int>();
+        };
+
+        EXPECT_EQ(source("a") == source("b"), mode != no_dedup);
+        EXPECT_EQ(source("a") == source("c"), mode == dedup_content);
+        EXPECT_NE(source("a"), source("d"));
+        EXPECT_NE(source("a"), source("e"));
+
+        for (auto name : { "a", "b", "c", "e" })
+        {
+            auto data = result.get_array<uint8_t>(result[name]).read();
+            EXPECT_TRUE(std::equal(mask.begin(), mask.end(), data.get()));
+        }
+
+        auto data = result.get_array<uint8_t>(result["d"]).read();
+        EXPECT_TRUE(std::equal(other.begin(), other.end(), data.get()));
+    }
+}
+
+TEST(WriterTest, BlockDedupLateChange)
+{
+    std::vector<uint16_t> first(3000, 7), second(3000, 7), third(3000, 9);
+
+    AsdfFile asdf;
+    asdf.set_block_dedup(dedup_content);
+
+    Node tree = asdf.get_tree();
+    tree["first"] = asdf.create_array_node<uint16_t>(first.data(), first.size(),
+                                                     CompressionType::zlib);
+    tree["second"] = asdf.create_array_node<uint16_t>(second.data(),
+                                                      second.size(),
+                                                      CompressionType::zlib);
+    tree["third"] = asdf.create_array_node<uint16_t>(third.data(), third.size(),
+                                                     CompressionType::zlib);
+
+    /* Buffers are compared when the file is written, not when added */
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::stringstream stream;
+        stream << asdf;
+
+        AsdfFile result(stream);
+        const int first_source = result["first"]["source"].as<int>();
+        const int second_source = result["second"]["source"].as<int>();
+        const int third_source = result["third"]["source"].as<int>();
+
+        EXPECT_EQ(first_source == second_source, pass == 0);
+        EXPECT_EQ(third_source, pass == 0 ? 1 : 2);
+
+        for (auto name : { "first", "second", "third" })
+        {
+            auto expected = std::string(name) == "first" ? first :
+                (std::string(name) == "second" ? second : third);
+            auto data = result.get_array<uint16_t>(result[name]).read();
+            EXPECT_TRUE(std::equal(expected.begin(), expected.end(),
+                                   data.get()));
+        }
+
+        second[10] = 8;
+    }
+}
+
+TEST(WriterTest, InlineArrays)
+{
+    int32_t small[3] = { -7, 0, 2147483647 };
+    double matrix[2][2] = { { 0.1, -1e300 }, { NAN, -INFINITY } };
+    bool mask[4] = { true, false, false, true };
+    std::vector<float> large(100, 0.5f);
+
+    AsdfFile asdf;
+    asdf.set_inline_threshold(10);
+
+    Node tree = asdf.get_tree();
+    tree["small"] = asdf.create_array_node<int32_t>(small, 3,
+                                                    CompressionType::zlib);
+    tree["matrix"] = asdf.create_array_node<double>(
+            (double *) matrix, std::vector<size_t> { 2, 2 });
+    tree["mask"] = asdf.create_array_node<bool>(mask, 4);
+    tree["large"] = asdf.create_array_node<float>(large.data(), large.size());
+
+    std::stringstream stream;
+    stream << asdf;
+
+    AsdfFile result(stream);
+    EXPECT_EQ(result["small"]["data"].size(), 3);
+    EXPECT_FALSE(result["small"]["source"].IsDefined());
+    EXPECT_FALSE(result["small"]["byteorder"].IsDefined());
+    EXPECT_EQ(result["matrix"]["data"][1].size(), 2);
+    EXPECT_EQ(result["mask"]["data"][0].Scalar(), "true");
+    EXPECT_TRUE(result["large"]["source"].IsDefined());
+
+    auto array = result.get_array<int32_t>(result["small"]);
+    EXPECT_TRUE(array.is_inline());
+    EXPECT_EQ(array.get_compression_type(), CompressionType::none);
+    EXPECT_TRUE(std::equal(small, small + 3, array.read().get()));
+    EXPECT_EQ(array.view()[2], 2147483647);
+
+    auto values = result.get_array<double>(result["matrix"]).read();
+    EXPECT_EQ(values.get()[0], 0.1);
+    EXPECT_EQ(values.get()[1], -1e300);
+    EXPECT_TRUE(std::isnan(values.get()[2]));
+    EXPECT_EQ(values.get()[3], -INFINITY);
+
+    auto generic = result.get_generic_array(result["mask"]);
+    EXPECT_EQ(generic.get_dtype(), bool8_dtype);
+    auto flags = generic.read_as<int>();
+    EXPECT_EQ(std::vector<int>(flags.get(), flags.get() + 4),
+              std::vector<int>({ 1, 0, 0, 1 }));
+
+    auto large_array = result.get_array<float>(result["large"]);
+    EXPECT_FALSE(large_array.is_inline());
+    EXPECT_TRUE(std::equal(large.begin(), large.end(),
+                           large_array.read().get()));
+}
+
+/* Uses a decimal comma, for systems that don't have such a locale installed */
+struct comma_numpunct : std::numpunct<char>
+{
+    char do_decimal_point() const
+    {
+        return ',';
+    }
+};
+
+TEST(WriterTest, InlineArraysLocale)
+{
+    /* A locale with a decimal comma must not leak into the tree */
+    std::locale previous;
+    bool found = false;
+    for (auto name : { "de_DE.UTF-8", "fr_FR.UTF-8", "de_DE", "fr_FR" })
+    {
+        try
+        {
+            std::locale::global(std::locale(name));
+            found = true;
+            break;
+        }
+        catch (const std::runtime_error &)
+        {
+        }
+    }
+
+    if (not found)
+    {
+        std::locale::global(std::locale(std::locale::classic(),
+                                        new comma_numpunct));
+    }
+
+    double values[3] = { 0.5, -1.25e-7, 3.0 };
+
+    AsdfFile asdf;
+    asdf.set_inline_threshold(10);
+    asdf.get_tree()["values"] = asdf.create_array_node<double>(values, 3);
+
+    std::stringstream stream;
+    stream << asdf;
+
+    AsdfFile result(stream);
+    const std::string first = result["values"]["data"][0].Scalar();
+    auto data = result.get_array<double>(result["values"]).read();
+
+    std::locale::global(previous);
+
+    EXPECT_EQ(first, "0.5");
+    EXPECT_TRUE(std::equal(values, values + 3, data.get()));
+}
+
+TEST(ReaderTest, InlineArrays)
+{
+    /* Written by hand, without a datatype or shape for some arrays */
+    std::stringstream stream(
+        "#ASDF 1.0.0\n"
+        "#ASDF_STANDARD 1.2.0\n"
+        "%YAML 1.1\n"
+        "%TAG ! tag:stsci.edu:asdf/\n"
+        "--- !core/asdf-1.1.0\n"
+        "ints: !core/ndarray-1.0.0\n"
+        "  data: [[1, 2, 3], [4, 5, 0x10]]\n"
+        "floats: !core/ndarray-1.0.0\n"
+        "  data: [1, 2.5, .inf, -.5]\n"
+        "bytes: !core/ndarray-1.0.0\n"
+        "  data: [[1, 2], [3, 4]]\n"
+        "  datatype: uint8\n"
+        "  shape: [4]\n"
+        "bad: !core/ndarray-1.0.0\n"
+        "  data: [1, 2, 3]\n"
+        "  datatype: int16\n"
+        "  shape: [2]\n"
+        "...\n");
+
+    AsdfFile asdf(stream);
+
+    auto ints = asdf.get_generic_array(asdf["ints"]);
+    EXPECT_EQ(ints.get_dtype(), int64_dtype);
+    EXPECT_EQ(ints.get_shape(), std::vector<size_t>({ 2, 3 }));
+    auto int_data = ints.read_as<int64_t>();
+    EXPECT_EQ(std::vector<int64_t>(int_data.get(), int_data.get() + 6),
+              std::vector<int64_t>({ 1, 2, 3, 4, 5, 16 }));
+
+    auto column = ints.read_slab_as<float>({ 0, 1 }, { 2, 1 });
+    EXPECT_EQ(column.get()[1], 5.0f);
+
+    auto floats = asdf.get_array<double>(asdf["floats"]).read();
+    EXPECT_EQ(floats.get()[1], 2.5);
+    EXPECT_EQ(floats.get()[2], INFINITY);
+    EXPECT_EQ(floats.get()[3], -0.5);
+
+    auto bytes = asdf.get_array<uint8_t>(asdf["bytes"]);
+    EXPECT_EQ(bytes.get_shape(), std::vector<size_t>({ 4 }));
+    EXPECT_EQ(bytes.read().get()[3], 4);
+
+    EXPECT_THROW(asdf.get_array<int16_t>(asdf["bad"]), std::runtime_error);
+}
@@ -1,4 +1,5 @@
 #include <cstdint>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -55,3 +56,89 @@ TEST(ByteswapTest, SwapU64)
         ASSERT_EQ(data[i], 0xefbeaddecefa0df0);
     }
 }
+
+TEST(ByteswapTest, SwapUnaligned)
+{
+    /* Odd lengths and offsets cover the tails of the vectorized kernels */
+    for (size_t count : { 1, 3, 17, 33, 130 })
+    {
+        std::vector<uint8_t> buffer(count * 8 + 1);
+        for (size_t i = 0; i < buffer.size(); i++)
+        {
+            buffer[i] = (uint8_t) i;
+        }
+
+        uint64_t *data = (uint64_t *) (buffer.data() + 1);
+        byteswap_data(data, count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            for (size_t j = 0; j < 8; j++)
+            {
+                ASSERT_EQ(buffer[1 + i * 8 + j], (uint8_t) (1 + i * 8 + 7 - j));
+            }
+        }
+    }
+}
+
+TEST(ByteswapTest, SwapCopy)
+{
+    std::vector<uint16_t> src(1001), dst(1001);
+    for (size_t i = 0; i < src.size(); i++)
+    {
+        src[i] = (uint16_t) i;
+    }
+
+    byteswap_copy(dst.data(), src.data(), src.size(), sizeof(uint16_t));
+
+    for (size_t i = 0; i < src.size(); i++)
+    {
+        ASSERT_EQ(src[i], (uint16_t) i);
+        ASSERT_EQ(dst[i], bswap_16((uint16_t) i));
+    }
+}
+
+TEST(ByteswapTest, SwapLarge)
+{
+    /* Larger than the caches, as when a whole array is swapped at once */
+    std::vector<uint32_t> data(1ul << 23);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (uint32_t) i;
+    }
+
+    byteswap_data(data.data(), data.size());
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        ASSERT_EQ(data[i], bswap_32((uint32_t) i));
+    }
+}
+
+TEST(ByteswapTest, SwapLargeOnPool)
+{
+    std::vector<uint64_t> data(1ul << 22);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = i;
+    }
+
+    Asdf::ThreadPool pool(3);
+    byteswap_data(data.data(), data.size(), &pool);
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        ASSERT_EQ(data[i], bswap_64((uint64_t) i));
+    }
+
+    /* A single worker must not wait for parts that are queued behind it */
+    Asdf::ThreadPool single(1);
+    single.submit([&]() {
+        byteswap_data(data.data(), data.size(), &single);
+    }).get();
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        ASSERT_EQ(data[i], (uint64_t) i);
+    }
+}
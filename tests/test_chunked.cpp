@@ -0,0 +1,114 @@
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <asdf-cpp/asdf.hpp>
+
+#include "gtest/gtest.h"
+
+using namespace Asdf;
+
+
+static const size_t rows = 100;
+static const size_t cols = 70;
+
+static std::vector<double> make_array(void)
+{
+    std::vector<double> data;
+    for (size_t i = 0; i < rows * cols; i++)
+    {
+        data.push_back(i);
+    }
+
+    return data;
+}
+
+static std::string write_chunked(std::vector<double> &data,
+                                 CompressionType compression)
+{
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+
+    tree["cube"] = asdf.create_array_node<double>(
+            data.data(), std::vector<size_t> { rows, cols }, compression,
+            std::vector<size_t> { 32, 32 });
+
+    std::stringstream stream;
+    stream << asdf;
+    return stream.str();
+}
+
+TEST(ChunkedTest, ReadWhole)
+{
+    auto data = make_array();
+
+    for (auto compression : { CompressionType::none, CompressionType::zlib })
+    {
+        std::stringstream stream(write_chunked(data, compression));
+        AsdfFile asdf(stream);
+
+        Node node = asdf["cube"];
+        EXPECT_EQ(node.Tag(), CHUNKED_NDARRAY_TAG);
+        EXPECT_EQ(node["chunks"].size(), 4 * 3);
+
+        auto array = asdf.get_array<double>(node);
+        EXPECT_TRUE(array.is_chunked());
+        EXPECT_EQ(array.get_chunk_shape(), std::vector<size_t>({ 32, 32 }));
+        EXPECT_EQ(array.get_compression_type(), compression);
+        EXPECT_EQ(array.get_num_elements(), rows * cols);
+
+        auto result = array.read();
+        EXPECT_TRUE(std::equal(data.begin(), data.end(), result.get()));
+    }
+}
+
+TEST(ChunkedTest, ReadSlab)
+{
+    auto data = make_array();
+    std::stringstream stream(write_chunked(data, CompressionType::zlib));
+    AsdfFile asdf(stream);
+    auto array = asdf.get_array<double>(asdf["cube"]);
+
+    const std::vector<size_t> start { 10, 5 };
+    const std::vector<size_t> count { 50, 60 };
+
+    ThreadPool pool(4);
+    for (auto p : { (ThreadPool *) nullptr, &pool })
+    {
+        auto slab = array.read_slab(start, count, p);
+        for (size_t i = 0; i < count[0]; i++)
+        {
+            for (size_t j = 0; j < count[1]; j++)
+            {
+                ASSERT_EQ(slab.get()[i * count[1] + j],
+                          data[(start[0] + i) * cols + start[1] + j]);
+            }
+        }
+    }
+
+    /* A single row only touches the chunks along that row */
+    auto row = array.read_slab({ 99, 0 }, { 1, cols });
+    EXPECT_TRUE(std::equal(data.end() - cols, data.end(), row.get()));
+
+    EXPECT_THROW(array.read_slab({ 99, 0 }, { 2, cols }), std::runtime_error);
+}
+
+TEST(ChunkedTest, ReadSlabUnchunked)
+{
+    auto data = make_array();
+
+    AsdfFile asdf;
+    asdf.get_tree()["array"] = asdf.create_array_node<double>(
+            data.data(), std::vector<size_t> { rows, cols });
+
+    std::stringstream stream;
+    stream << asdf;
+
+    AsdfFile new_asdf(stream);
+    auto array = new_asdf.get_array<double>(new_asdf["array"]);
+    EXPECT_FALSE(array.is_chunked());
+
+    auto slab = array.read_slab({ 1, 2 }, { 2, 3 });
+    EXPECT_EQ(slab.get()[0], data[1 * cols + 2]);
+    EXPECT_EQ(slab.get()[5], data[2 * cols + 4]);
+}
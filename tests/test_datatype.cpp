@@ -1,9 +1,18 @@
 #include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <limits>
 
 #include "gtest/gtest.h"
 
 #include <asdf-cpp/asdf.hpp>
 #include <asdf-cpp/datatypes.hpp>
+#include <asdf-cpp/convert.hpp>
+
+using namespace Asdf;
 
 
 TEST(DatatypeTest, DtypeToString)
@@ -63,3 +72,204 @@ TEST(DatatypeTest, DtypeMatches)
     EXPECT_FALSE(dtype_matches<float>("int8"));
     EXPECT_FALSE(dtype_matches<double>("uint64"));
 }
+
+TEST(DatatypeTest, DTypeEnum)
+{
+    for (int i = 0; i < unknown_dtype; i++)
+    {
+        DType dtype = (DType) i;
+        EXPECT_EQ(DType_from_string(DType_to_string(dtype)), dtype);
+    }
+
+    EXPECT_EQ(DType_from_string("complex128"), unknown_dtype);
+    EXPECT_EQ(DType_size(unknown_dtype), 0);
+
+    EXPECT_EQ(dtype_of<int16_t>(), int16_dtype);
+    EXPECT_EQ(dtype_of<float>(), float32_dtype);
+    EXPECT_EQ(dtype_of<bool>(), bool8_dtype);
+    EXPECT_EQ(DType_size(dtype_of<double>()), sizeof(double));
+}
+
+template <typename S, typename D>
+static void check_conversion(void)
+{
+    /* Odd counts exercise the scalar tail after the vector kernels */
+    for (size_t count : { 0, 7, 33, 5000 })
+    {
+        std::vector<S> src(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            src[i] = (S) ((i * 37) % 101);
+        }
+
+        std::vector<S> swapped(src);
+        byteswap_data(swapped.data(), count);
+
+        for (bool swap : { false, true })
+        {
+            /* Not a vector, since vector<bool> has no data() */
+            std::unique_ptr<D[]> dst(new D[count + 1]);
+            std::fill(dst.get(), dst.get() + count + 1, (D) 3);
+
+            convert_data(dst.get(), dtype_of<D>(),
+                         swap ? swapped.data() : src.data(), dtype_of<S>(),
+                         count, swap);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                ASSERT_EQ(dst[i], (D) src[i]);
+            }
+
+            /* Nothing past the end is written */
+            ASSERT_EQ(dst[count], (D) 3);
+        }
+    }
+}
+
+TEST(DatatypeTest, Convert)
+{
+    check_conversion<int8_t, float>();
+    check_conversion<uint8_t, float>();
+    check_conversion<int16_t, float>();
+    check_conversion<uint16_t, float>();
+    check_conversion<int32_t, float>();
+    check_conversion<double, float>();
+    check_conversion<int16_t, double>();
+    check_conversion<int32_t, double>();
+    check_conversion<float, double>();
+    check_conversion<uint8_t, bool>();
+    check_conversion<int8_t, bool>();
+    check_conversion<uint64_t, int32_t>();
+    check_conversion<float, int16_t>();
+    check_conversion<int64_t, int64_t>();
+
+    /* Stored booleans may hold any nonzero value */
+    uint8_t raw[40];
+    bool values[40];
+    for (size_t i = 0; i < 40; i++)
+    {
+        raw[i] = (i % 3) * 100;
+    }
+
+    convert_data(values, bool8_dtype, raw, bool8_dtype, 40);
+    for (size_t i = 0; i < 40; i++)
+    {
+        uint8_t byte;
+        memcpy(&byte, &values[i], 1);
+        ASSERT_EQ(byte, raw[i] ? 1 : 0);
+    }
+
+    EXPECT_THROW(convert_data(values, unknown_dtype, raw, uint8_dtype, 1),
+                 std::runtime_error);
+}
+
+TEST(DatatypeTest, ConvertSaturates)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    float values[] = { nan, inf, -inf, 1e10f, -1e10f, 3.7f, -3.7f,
+                       32767.0f, -32768.0f, 40000.0f };
+
+    int16_t int16[10];
+    convert_data(int16, int16_dtype, values, float32_dtype, 10);
+    const int16_t expected_int16[] = { 0, 32767, -32768, 32767, -32768, 3, -3,
+                                       32767, -32768, 32767 };
+    EXPECT_TRUE(std::equal(int16, int16 + 10, expected_int16));
+
+    uint8_t uint8[10];
+    convert_data(uint8, uint8_dtype, values, float32_dtype, 10);
+    const uint8_t expected_uint8[] = { 0, 255, 0, 255, 0, 3, 0, 255, 0, 255 };
+    EXPECT_TRUE(std::equal(uint8, uint8 + 10, expected_uint8));
+
+    /* The highest int64 isn't representable, so 2^63 must saturate too */
+    const double big[] = { 9223372036854775808.0, -9223372036854775808.0,
+                           1e300, 4611686018427387904.0 };
+    int64_t int64[4];
+    convert_data(int64, int64_dtype, big, float64_dtype, 4);
+    EXPECT_EQ(int64[0], std::numeric_limits<int64_t>::max());
+    EXPECT_EQ(int64[1], std::numeric_limits<int64_t>::min());
+    EXPECT_EQ(int64[2], std::numeric_limits<int64_t>::max());
+    EXPECT_EQ(int64[3], 4611686018427387904ll);
+
+    /* The same applies when reading a stored array */
+    AsdfFile asdf;
+    asdf.get_tree()["values"] = asdf.create_array_node<float>(values, 10);
+
+    std::stringstream stream;
+    stream << asdf;
+
+    AsdfFile result(stream);
+    auto data = result.get_generic_array(result["values"]).read_as<int16_t>();
+    EXPECT_TRUE(std::equal(data.get(), data.get() + 10, expected_int16));
+}
+
+TEST(DatatypeTest, GenericArray)
+{
+    std::vector<int16_t> pixels;
+    std::vector<uint8_t> mask;
+    for (size_t i = 0; i < 10000; i++)
+    {
+        pixels.push_back((int16_t) (i * 13 % 4001) - 2000);
+        mask.push_back((i % 5) * 60);
+    }
+
+    CompressionOptions shuffled(CompressionType::zlib);
+    shuffled.shuffle = byte_shuffle;
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+    tree["plain"] = asdf.create_array_node<int16_t>(pixels.data(),
+                                                    pixels.size());
+    tree["swapped"] = asdf.create_array_node<int16_t>(pixels.data(),
+            pixels.size(), CompressionType::zlib, big_endian);
+    tree["shuffled"] = asdf.create_array_node<int16_t>(pixels.data(),
+            pixels.size(), shuffled, big_endian);
+    tree["chunked"] = asdf.create_array_node<int16_t>(pixels.data(),
+            std::vector<size_t> { 100, 100 }, CompressionType::bzip2,
+            std::vector<size_t> { 30, 30 }, big_endian);
+    tree["mask"] = asdf.create_array_node<uint8_t>(mask.data(), mask.size(),
+                                                   CompressionType::zlib);
+
+    std::stringstream stream;
+    stream << asdf;
+
+    AsdfFile result(stream);
+    for (auto name : { "plain", "swapped", "shuffled", "chunked" })
+    {
+        GenericNDArray array = result.get_generic_array(result[name]);
+        EXPECT_EQ(array.get_dtype(), int16_dtype);
+
+        auto values = array.read_as<float>();
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            ASSERT_EQ(values.get()[i], (float) pixels[i]);
+        }
+
+        auto same = array.read_as<int16_t>();
+        EXPECT_TRUE(std::equal(pixels.begin(), pixels.end(), same.get()));
+
+        /* Columns 20 to 59 of every row */
+        auto shape = array.get_shape();
+        std::vector<size_t> start(shape.size(), 0), count(shape);
+        start.back() = 20;
+        count.back() = 40;
+
+        auto slab = array.read_slab_as<double>(start, count);
+        const size_t rows = pixels.size() / shape.back();
+        EXPECT_EQ(slab.get()[0], (double) pixels[20]);
+        EXPECT_EQ(slab.get()[rows * 40 - 1],
+                  (double) pixels[pixels.size() - shape.back() + 59]);
+    }
+
+    GenericNDArray array = result.get_generic_array(result["mask"]);
+    EXPECT_EQ(array.get_dtype(), uint8_dtype);
+
+    auto flags = array.read_as<bool>();
+    for (size_t i = 0; i < mask.size(); i++)
+    {
+        ASSERT_EQ(flags.get()[i], mask[i] != 0);
+    }
+
+    /* The typed interface still rejects other element types */
+    EXPECT_THROW(result.get_array<float>(result["plain"]), std::runtime_error);
+}
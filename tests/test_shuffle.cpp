@@ -0,0 +1,169 @@
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <asdf-cpp/asdf.hpp>
+#include <asdf-cpp/shuffle.hpp>
+
+#include "gtest/gtest.h"
+
+using namespace Asdf;
+
+
+static std::vector<uint8_t> make_bytes(size_t size)
+{
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = (uint8_t) (i * 7 + (i >> 8));
+    }
+
+    return data;
+}
+
+TEST(ShuffleTest, ByteShuffle)
+{
+    /* Odd counts exercise the scalar tail after the vector kernels */
+    for (size_t elem_size : { 1, 2, 3, 4, 8, 16 })
+    {
+        for (size_t count : { 0, 5, 16, 77, 1000 })
+        {
+            auto src = make_bytes(count * elem_size);
+            std::vector<uint8_t> shuffled(src.size()), result(src.size());
+
+            shuffle_data(shuffled.data(), src.data(), count, elem_size,
+                         byte_shuffle);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                for (size_t j = 0; j < elem_size; j++)
+                {
+                    ASSERT_EQ(shuffled[j * count + i], src[i * elem_size + j]);
+                }
+            }
+
+            unshuffle_data(result.data(), shuffled.data(), count, elem_size,
+                           byte_shuffle);
+            ASSERT_EQ(result, src);
+        }
+    }
+}
+
+TEST(ShuffleTest, BitShuffle)
+{
+    for (size_t elem_size : { 1, 4, 8 })
+    {
+        /* Group counts that leave tails after the two and four group kernels */
+        for (size_t count : { 3, 24, 64, 1003 })
+        {
+            auto src = make_bytes(count * elem_size);
+            std::vector<uint8_t> shuffled(src.size()), result(src.size());
+
+            shuffle_data(shuffled.data(), src.data(), count, elem_size,
+                         bit_shuffle);
+
+            /* Check the bits of every group of elements in each plane */
+            const size_t groups = count / 8;
+            for (size_t j = 0; j < elem_size; j++)
+            {
+                for (size_t g = 0; g < groups; g++)
+                {
+                    for (size_t i = 0; i < 8; i++)
+                    {
+                        for (size_t k = 0; k < 8; k++)
+                        {
+                            uint8_t row = shuffled[j * count + k * groups + g];
+                            uint8_t byte = src[(8 * g + i) * elem_size + j];
+                            ASSERT_EQ((row >> i) & 1, (byte >> k) & 1);
+                        }
+                    }
+                }
+            }
+
+            unshuffle_data(result.data(), shuffled.data(), count, elem_size,
+                           bit_shuffle);
+            ASSERT_EQ(result, src);
+        }
+    }
+}
+
+TEST(ShuffleTest, CompressedArray)
+{
+    std::vector<double> data;
+    for (size_t i = 0; i < 10000; i++)
+    {
+        data.push_back(i * 0.25);
+    }
+
+    for (auto filter : { no_shuffle, byte_shuffle, bit_shuffle })
+    {
+        CompressionOptions options(CompressionType::zlib);
+        options.shuffle = filter;
+
+        AsdfFile asdf;
+        Node tree = asdf.get_tree();
+        tree["plain"] = asdf.create_array_node<double>(data.data(),
+                                                       data.size(), options);
+        tree["chunked"] = asdf.create_array_node<double>(
+                data.data(), std::vector<size_t> { 100, 100 }, options,
+                std::vector<size_t> { 30, 30 });
+
+        std::stringstream stream;
+        stream << asdf;
+
+        AsdfFile result(stream);
+        for (auto name : { "plain", "chunked" })
+        {
+            Node node = result[name];
+            if (filter == no_shuffle)
+            {
+                EXPECT_FALSE(node["shuffle"].IsDefined());
+            }
+            else
+            {
+                EXPECT_EQ(node["shuffle"].as<std::string>(),
+                          ShuffleType_to_string(filter));
+            }
+
+            /* Other readers must not mistake shuffled data for plain data */
+            if (std::string(name) == "chunked")
+            {
+                EXPECT_EQ(node.Tag(), CHUNKED_NDARRAY_TAG);
+            }
+            else
+            {
+                EXPECT_EQ(node.Tag(), filter == no_shuffle ?
+                          NDARRAY_TAG : SHUFFLED_NDARRAY_TAG);
+            }
+
+            auto array = result.get_array<double>(node);
+            EXPECT_EQ(array.get_shuffle(), filter);
+
+            auto values = array.read();
+            EXPECT_TRUE(std::equal(data.begin(), data.end(), values.get()));
+        }
+    }
+}
+
+TEST(ShuffleTest, UncompressedIgnored)
+{
+    std::vector<float> data(100, 1.5f);
+
+    CompressionOptions options(CompressionType::none);
+    options.shuffle = byte_shuffle;
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+    tree["data"] = asdf.create_array_node<float>(data.data(), data.size(),
+                                                 options);
+
+    std::stringstream stream;
+    stream << asdf;
+
+    AsdfFile result(stream);
+    EXPECT_FALSE(result["data"]["shuffle"].IsDefined());
+
+    auto array = result.get_array<float>(result["data"]);
+    EXPECT_EQ(array.get_shuffle(), no_shuffle);
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), array.read().get()));
+}
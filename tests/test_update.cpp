@@ -0,0 +1,183 @@
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+
+#include <asdf-cpp/asdf.hpp>
+
+#include "gtest/gtest.h"
+
+extern std::string test_output_path;
+using namespace Asdf;
+
+
+static std::string write_padded_file(std::string name, std::vector<int> &nums,
+                                     CompressionType compression)
+{
+    std::string path = test_output_path + name;
+
+    AsdfFile asdf;
+    asdf.set_padding(1000, 0.5);
+
+    Node tree = asdf.get_tree();
+    tree["nums"] = asdf.create_array_node<int>(nums.data(), nums.size(),
+                                               compression);
+    tree["name"] = "original";
+
+    std::ofstream ofs(path);
+    ofs << asdf;
+
+    return path;
+}
+
+TEST(UpdateTest, PaddedFile)
+{
+    std::vector<int> nums(100);
+    for (int i = 0; i < 100; i++)
+    {
+        nums[i] = i;
+    }
+
+    AsdfFile asdf(write_padded_file("padded.asdf", nums, zlib));
+    auto array = asdf.get_array<int>(asdf["nums"]);
+    auto data = array.read();
+
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQ(data.get()[i], i);
+    }
+}
+
+TEST(UpdateTest, UpdateTree)
+{
+    std::vector<int> nums(100, 7);
+    std::string path = write_padded_file("update-tree.asdf", nums,
+                                         CompressionType::none);
+
+    {
+        AsdfFile asdf(path, read_write);
+        asdf["name"] = std::string(500, 'x');
+        EXPECT_TRUE(asdf.update_tree());
+
+        /* This no longer fits before the first block */
+        asdf["name"] = std::string(5000, 'x');
+        EXPECT_FALSE(asdf.update_tree());
+    }
+
+    AsdfFile asdf(path);
+    EXPECT_EQ(asdf["name"].as<std::string>(), std::string(500, 'x'));
+
+    auto array = asdf.get_array<int>(asdf["nums"]);
+    EXPECT_EQ(array.get_raw_data()[99], 7);
+}
+
+TEST(UpdateTest, UpdateBlock)
+{
+    std::vector<int> nums(100, 0);
+    std::string path = write_padded_file("update-block.asdf", nums, zlib);
+
+    std::vector<int> random(100);
+    for (int i = 0; i < 100; i++)
+    {
+        random[i] = (i * 2654435761u) >> 7;
+    }
+
+    {
+        AsdfFile asdf(path, read_write);
+
+        /* The compressed zeros leave far too little room for noise */
+        EXPECT_FALSE(asdf.update_block(0, random.data(), 400, zlib));
+
+        std::vector<int> ones(100, 1);
+        EXPECT_TRUE(asdf.update_block(0, ones.data(), 400, zlib));
+    }
+
+    AsdfFile asdf(path);
+    auto array = asdf.get_array<int>(asdf["nums"]);
+    auto data = array.read();
+
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQ(data.get()[i], 1);
+    }
+}
+
+TEST(UpdateTest, Append)
+{
+    std::vector<int> nums(100);
+    for (int i = 0; i < 100; i++)
+    {
+        nums[i] = i;
+    }
+
+    std::string path = write_padded_file("append.asdf", nums, zlib);
+
+    std::vector<double> more(50);
+    for (int i = 0; i < 50; i++)
+    {
+        more[i] = i / 2.0;
+    }
+
+    {
+        AsdfFile asdf(path, read_write);
+        Node tree = asdf.get_tree();
+
+        tree["more"] = asdf.create_array_node<double>(more.data(), more.size());
+        EXPECT_EQ(tree["more"]["source"].as<int>(), 1);
+
+        asdf.append();
+
+        /* The file is reloaded, so it can be appended to again */
+        tree = asdf.get_tree();
+        tree["last"] = asdf.create_array_node<int>(nums.data(), 10, bzip2);
+        asdf.append();
+    }
+
+    AsdfFile asdf(path);
+
+    auto array = asdf.get_array<int>(asdf["nums"]);
+    auto data = array.read();
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQ(data.get()[i], i);
+    }
+
+    auto more_array = asdf.get_array<double>(asdf["more"]);
+    auto more_data = more_array.read();
+    for (int i = 0; i < 50; i++)
+    {
+        ASSERT_EQ(more_data.get()[i], i / 2.0);
+    }
+
+    auto last = asdf.get_array<int>(asdf["last"]);
+    EXPECT_EQ(last.get_source(), 2);
+    EXPECT_EQ(last.read().get()[9], 9);
+
+    /* The block index must cover the old blocks as well as the new ones */
+    std::ifstream ifs(path);
+    std::string contents((std::istreambuf_iterator<char>(ifs)),
+                         std::istreambuf_iterator<char>());
+    size_t index = contents.rfind(BLOCK_INDEX_HEADER);
+    ASSERT_NE(index, std::string::npos);
+    EXPECT_EQ(std::count(contents.begin() + index, contents.end(), ','), 2);
+}
+
+TEST(UpdateTest, AppendWithoutPadding)
+{
+    std::string path = test_output_path + "append-full.asdf";
+    std::vector<int> nums(10, 3);
+
+    {
+        AsdfFile asdf;
+        asdf.get_tree()["nums"] = asdf.create_array_node<int>(nums.data(), 10);
+
+        std::ofstream ofs(path);
+        ofs << asdf;
+    }
+
+    AsdfFile asdf(path, read_write);
+    asdf["more"] = asdf.create_array_node<int>(nums.data(), 10);
+    EXPECT_THROW(asdf.append(), std::runtime_error);
+}
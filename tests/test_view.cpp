@@ -0,0 +1,282 @@
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+#include <asdf-cpp/asdf.hpp>
+
+#include "gtest/gtest.h"
+
+extern std::string test_output_path;
+using namespace Asdf;
+
+
+static std::string write_2d_file(std::string name, bool big_endian = false)
+{
+    std::string path = test_output_path + name;
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+
+    uint32_t array_2d[10][20];
+    for (int i = 0; i < 10; i++)
+    {
+        for (int j = 0; j < 20; j++)
+        {
+            array_2d[i][j] = 20*i + j;
+        }
+    }
+
+    if (big_endian)
+    {
+        byteswap_data((uint32_t *) array_2d, 200);
+    }
+
+    tree["array"] = asdf.create_array_node<uint32_t>(
+            (uint32_t *) array_2d, std::vector<size_t> { 10, 20 });
+
+    std::stringstream stream;
+    stream << asdf;
+    std::string contents = stream.str();
+
+    if (big_endian)
+    {
+        /* Keep the length the same so the block index remains valid */
+        size_t pos = contents.find("byteorder: little");
+        contents.replace(pos, 17, "byteorder: big   ");
+    }
+
+    std::ofstream ofs(path);
+    ofs << contents;
+
+    return path;
+}
+
+static void verify_view(const ArrayView<const uint32_t> &view)
+{
+    ASSERT_EQ(view.get_shape(), std::vector<size_t>({ 10, 20 }));
+    ASSERT_EQ(view.size(), 200);
+
+    for (int i = 0; i < 10; i++)
+    {
+        for (int j = 0; j < 20; j++)
+        {
+            ASSERT_EQ(view(i, j), 20*i + j);
+            ASSERT_EQ(view[20*i + j], 20*i + j);
+        }
+    }
+}
+
+TEST(ArrayViewTest, ZeroCopy)
+{
+    AsdfFile asdf(write_2d_file("view.asdf"));
+    auto array = asdf.get_array<uint32_t>(asdf.get_tree()["array"]);
+
+    auto view = array.view();
+    EXPECT_FALSE(view.is_copy());
+    EXPECT_EQ(view.data(), array.get_raw_data());
+    verify_view(view);
+}
+
+TEST(ArrayViewTest, OutlivesFile)
+{
+    ArrayView<const uint32_t> view;
+
+    {
+        AsdfFile asdf(write_2d_file("view.asdf"));
+        view = asdf.get_array<uint32_t>(asdf.get_tree()["array"]).view();
+    }
+
+    verify_view(view);
+}
+
+TEST(ArrayViewTest, Byteswap)
+{
+    AsdfFile asdf(write_2d_file("view-big.asdf", true));
+    auto array = asdf.get_array<uint32_t>(asdf.get_tree()["array"]);
+
+    auto view = array.view();
+    EXPECT_TRUE(view.is_copy());
+    verify_view(view);
+
+    /* The file itself must not have been modified */
+    EXPECT_EQ(array.get_raw_data()[1], 0x01000000);
+}
+
+TEST(ArrayViewTest, WritableView)
+{
+    std::string path = write_2d_file("view-rw.asdf");
+
+    {
+        AsdfFile asdf(path, read_write);
+        auto array = asdf.get_array<uint32_t>(asdf.get_tree()["array"]);
+
+        auto view = array.writable_view();
+        EXPECT_EQ(view.data(), array.get_raw_data());
+
+        for (int j = 0; j < 20; j++)
+        {
+            view(3, j) = 1000 + j;
+        }
+
+        view.flush();
+    }
+
+    AsdfFile asdf(path);
+    auto array = asdf.get_array<uint32_t>(asdf.get_tree()["array"]);
+    auto view = array.view();
+
+    for (int i = 0; i < 10; i++)
+    {
+        for (int j = 0; j < 20; j++)
+        {
+            ASSERT_EQ(view(i, j), i == 3 ? 1000 + j : 20*i + j);
+        }
+    }
+
+    /* The checksum must match the new contents of the block */
+    const uint8_t *block = (const uint8_t *) array.get_raw_data() - sizeof(block_header_t);
+    uint8_t checksum[16];
+    compute_checksum(checksum, (const uint8_t *) view.data(), 800);
+    EXPECT_EQ(memcmp(((const block_header_t *) block)->checksum, checksum, 16), 0);
+}
+
+TEST(ArrayViewTest, WritableViewReadOnly)
+{
+    AsdfFile asdf(write_2d_file("view.asdf"));
+    auto array = asdf.get_array<uint32_t>(asdf.get_tree()["array"]);
+
+    EXPECT_THROW(array.writable_view(), std::runtime_error);
+}
+
+TEST(ArrayViewTest, Checksum)
+{
+    const std::string message = "The quick brown fox jumps over the lazy dog";
+    const uint8_t expected[16] = {
+        0x9e, 0x10, 0x7d, 0x9d, 0x37, 0x2b, 0xb6, 0x82,
+        0x6b, 0xd8, 0x1d, 0x35, 0x42, 0xa4, 0x19, 0xd6
+    };
+
+    uint8_t checksum[16];
+    compute_checksum(checksum, (const uint8_t *) message.data(), message.size());
+    EXPECT_EQ(memcmp(checksum, expected, 16), 0);
+}
+
+static std::string write_views_file(std::string name,
+                                    CompressionType compression,
+                                    ByteOrder byteorder = native_byte_order)
+{
+    std::string path = test_output_path + name;
+
+    uint32_t array_2d[10][20];
+    for (int i = 0; i < 10; i++)
+    {
+        for (int j = 0; j < 20; j++)
+        {
+            array_2d[i][j] = 20*i + j;
+        }
+    }
+
+    AsdfFile asdf;
+    Node tree = asdf.get_tree();
+
+    auto base = asdf.create_array_node<uint32_t>((uint32_t *) array_2d,
+            std::vector<size_t> { 10, 20 }, compression, byteorder);
+    tree["array"] = base;
+
+    /* The transpose, rows 2 to 5 with every other column, and row 0 reversed */
+    tree["transpose"] = asdf.create_array_view(base, { 20, 10 }, { 4, 80 });
+    tree["slice"] = asdf.create_array_view(base, { 4, 10 }, { 80, 8 }, 160);
+    tree["reversed"] = asdf.create_array_view(base, { 20 }, { -4 }, 76);
+
+    EXPECT_THROW(asdf.create_array_view(base, { 20 }, { 4 }, 800 - 76),
+                 std::runtime_error);
+
+    std::ofstream ofs(path);
+    ofs << asdf;
+
+    return path;
+}
+
+/*
+ * Views of uncompressed blocks point into a memory map, which is a private
+ * copy if the data had to be byteswapped.
+ */
+static void verify_views(AsdfFile &asdf, bool copy, bool mapped)
+{
+    Node tree = asdf.get_tree();
+
+    /* All of the views refer to the block of the base array */
+    for (auto name : { "transpose", "slice", "reversed" })
+    {
+        EXPECT_EQ(tree[name]["source"].as<int>(), tree["array"]["source"].as<int>());
+    }
+
+    EXPECT_EQ(tree["transpose"]["order"].as<std::string>(), "F");
+    EXPECT_FALSE(tree["transpose"]["strides"].IsDefined());
+    EXPECT_EQ(tree["slice"]["offset"].as<size_t>(), 160);
+    EXPECT_EQ(tree["slice"]["strides"].as<std::vector<long>>(),
+              std::vector<long>({ 80, 8 }));
+
+    auto transpose = asdf.get_array<uint32_t>(tree["transpose"]);
+    auto slice = asdf.get_array<uint32_t>(tree["slice"]);
+    auto reversed = asdf.get_array<uint32_t>(tree["reversed"]);
+
+    auto transpose_view = transpose.view();
+    auto slice_view = slice.view();
+    auto reversed_view = reversed.view();
+    EXPECT_EQ(transpose_view.is_copy(), copy);
+    EXPECT_EQ(slice_view.is_copy(), copy);
+    EXPECT_EQ(transpose_view.is_contiguous(), not mapped);
+
+    auto transpose_data = transpose.read();
+    for (size_t i = 0; i < 20; i++)
+    {
+        for (size_t j = 0; j < 10; j++)
+        {
+            ASSERT_EQ(transpose_view(i, j), 20*j + i);
+            ASSERT_EQ(transpose_view[10*i + j], 20*j + i);
+            ASSERT_EQ(transpose_data.get()[10*i + j], 20*j + i);
+        }
+    }
+
+    auto slice_data = slice.read_as<double>();
+    for (size_t i = 0; i < 4; i++)
+    {
+        for (size_t j = 0; j < 10; j++)
+        {
+            ASSERT_EQ(slice_view(i, j), 20*(i + 2) + 2*j);
+            ASSERT_EQ(slice_data.get()[10*i + j], 20*(i + 2) + 2*j);
+        }
+    }
+
+    auto reversed_data = reversed.read();
+    for (size_t i = 0; i < 20; i++)
+    {
+        ASSERT_EQ(reversed_view[i], 19 - i);
+        ASSERT_EQ(reversed_data.get()[i], 19 - i);
+    }
+
+    auto region = transpose.read_slab({ 3, 1 }, { 2, 4 });
+    EXPECT_EQ(region.get()[0], 20*1 + 3);
+    EXPECT_EQ(region.get()[7], 20*4 + 4);
+}
+
+TEST(ArrayViewTest, SharedBlock)
+{
+    AsdfFile asdf(write_views_file("views.asdf", CompressionType::none));
+    verify_views(asdf, false, true);
+}
+
+TEST(ArrayViewTest, SharedBlockByteswap)
+{
+    AsdfFile asdf(write_views_file("views-big.asdf", CompressionType::none,
+                                   big_endian));
+    verify_views(asdf, true, true);
+}
+
+TEST(ArrayViewTest, SharedCompressedBlock)
+{
+    AsdfFile asdf(write_views_file("views-zlib.asdf", CompressionType::zlib));
+    verify_views(asdf, true, false);
+}